@@ -32,6 +32,16 @@ using std::cerr;
 using std::endl;
 #include <string>
 using std::string;
+#include <vector>
+using std::vector;
+#include <thread>
+using std::thread;
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+#include <atomic>
+using std::atomic;
+#include <stdexcept>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 using boost::filesystem::path;
@@ -63,9 +73,13 @@ void PrintVersion(ostream& os) {
 
 int main(int argc, const char * argv[]) {
   using namespace boost::program_options;
-  C52     c52;
   string  DataDir, NetIndicator, StartDate_str, EndDate_str;
   bool CX52 = false;
+  uint64_t Seed = 0;
+  unsigned Jobs = 1;
+  string  DrumCacheFile;
+  string  DrumCatalogFile;
+  bool Packed = false;
 
   // Parse command-line arguments
   options_description desc("C52 options description");
@@ -77,6 +91,11 @@ int main(int argc, const char * argv[]) {
   (",x",  bool_switch(&CX52), "Generate keys for CX52")
   (",s", value<string>(&StartDate_str), "the start date for the database in ISO format")
   (",e", value<string>(&EndDate_str), "the end date for the database in ISO format")
+  ("seed", value<uint64_t>(&Seed), "Seed the random number generator so that\nthe database can be regenerated exactly.")
+  (",j", value<unsigned>(&Jobs), "Number of keys to generate in parallel.")
+  ("packed", bool_switch(&Packed), (string("Write one indexed file NetIndicator") + C52::KEYDB_SUFFIX + "\ninstead of a file per day.").c_str())
+  ("drumCache", value<string>(&DrumCacheFile), "File in which good drums found are kept between runs.")
+  ("drumCatalog", value<string>(&DrumCatalogFile), "Pick drums from a catalog written by\nhagelin-drumcatalog instead of searching.")
   (",v", bool_switch(&Verbose), "Print verbose debug messages to stderr.");
 
   variables_map vm;
@@ -100,7 +119,12 @@ int main(int argc, const char * argv[]) {
     cerr << "Error: The -n option must be specified" << endl;
     exit (1);
   }
-  path p(DataDir + "/" + NetIndicator);
+  if (Jobs < 1) {
+    cerr << "Error: The -j option must be at least 1" << endl;
+    exit(1);
+  }
+  bool Seeded = vm.count("seed") > 0;
+  path p(Packed ? DataDir : DataDir + "/" + NetIndicator);
   create_directories(p);
   if (!is_directory(p)) {
     cerr << "Unable to create/open directory " << p << endl;
@@ -108,19 +132,88 @@ int main(int argc, const char * argv[]) {
   date StartDate = date_from_iso_string(StartDate_str);
   date EndDate = date_from_iso_string(EndDate_str);
 
-  for (day_iterator d_itr{StartDate}; (*d_itr) <= EndDate; ++d_itr) {
-    path fname{to_iso_string(*d_itr)+".c52key"};
-    ofstream fout(p / fname);
-    if (!fout) {
-      cerr << "Unable to open " << (p / fname) << endl;
+  if (!DrumCacheFile.empty() && C52::DrumSearchCache.Load(DrumCacheFile)) {
+    cout << "Loaded " << C52::DrumSearchCache.size()
+         << " NumArrays from " << DrumCacheFile << endl;
+  }
+
+  if (!DrumCatalogFile.empty()) {
+    try {
+      C52::LoadDrumCatalog(DrumCatalogFile);
+    } catch (std::runtime_error& e) {
+      cerr << "Error: " << e.what() << endl;
       exit(1);
-    } else {
-      cout << "Writing to file: " << (p / fname) << endl;
+    }
+  }
 
+  vector<date> Days;
+  for (day_iterator d_itr{StartDate}; (*d_itr) <= EndDate; ++d_itr) {
+    Days.push_back(*d_itr);
+  }
+
+  // Days are independent, so each worker takes the next day not yet
+  // started and generates it with its own C52 and its own generator.
+  // When a seed is given each day is generated from its own stream of
+  // the seed, so the files do not depend on the number of workers.
+  // In packed mode each worker stores its keys in Records and the data
+  // base is written once all days are done.
+  atomic<size_t> NextDay{0};
+  atomic<bool> Failed{false};
+  mutex OutMutex;
+  vector<KeyRecord> Records(Packed ? Days.size() : 0);
+  auto Worker = [&]() {
+    C52 c52;
+    for (size_t i = NextDay++; i < Days.size() && !Failed; i = NextDay++) {
+      if (Packed) {
+        if (Seeded) {
+          gen.seed(Seed, Days[i].day_number());
+        }
+        c52.GenKey(CX52);
+        Records[i] = c52.GetKeyRecord(NetIndicator, Days[i]);
+        continue;
+      }
+      path fname{to_iso_string(Days[i])+".c52key"};
+      ofstream fout(p / fname);
+      {
+        lock_guard<mutex> lock(OutMutex);
+        if (!fout) {
+          cerr << "Unable to open " << (p / fname) << endl;
+          Failed = true;
+          return;
+        } else {
+          cout << "Writing to file: " << (p / fname) << endl;
+        }
+      }
+      if (Seeded) {
+        gen.seed(Seed, Days[i].day_number());
+      }
+      c52.GenKey(CX52);
+      c52.PrintKey(NetIndicator, Days[i], fout);
+    }
+  };
+
+  vector<thread> Workers;
+  for (unsigned j=1; j<Jobs; ++j) {
+    Workers.push_back(thread(Worker));
+  }
+  Worker();
+  for (auto& w : Workers) {
+    w.join();
+  }
+
+  if (Packed) {
+    path fname = p / (NetIndicator + C52::KEYDB_SUFFIX);
+    cout << "Writing to file: " << fname << endl;
+    if (!KeyDataBase::Write(fname.string(), Records)) {
+      cerr << "Unable to write " << fname << endl;
+      Failed = true;
     }
-    c52.GenKey(CX52);
-    c52.PrintKey(NetIndicator, *d_itr, fout);
   }
 
-  return 0;
+  if (!DrumCacheFile.empty() && !C52::DrumSearchCache.Save(DrumCacheFile)) {
+    cerr << "Unable to write " << DrumCacheFile << endl;
+    Failed = true;
+  }
+
+  return Failed ? 1 : 0;
 }
@@ -50,6 +50,9 @@ bool Quiet = true;
 /// The M209GROUP keylists are assumed to be in ../../m209group-key-lists
 /// That would be a sister directory of hagelin is the current directory == build
 /// directory.
+/// If a file name is given, the keys are also written to it as a packed
+/// key data base, so it can be copied to M209_KEYLIST_DIR as
+/// M209GROUP.m209db.
 int main(int argc, const char * argv[]) {
   using namespace boost::program_options;
   string root_dir = "../../m209group-key-lists/";
@@ -61,6 +64,7 @@ int main(int argc, const char * argv[]) {
   int count_good = 0;
   int count_broken_good = 0;
   int count_fixed_good = 0;
+  vector<KeyRecord> records;
   for (day_iterator d_itr{d_start}; (*d_itr) <= d_end; ++d_itr) {
     string d_str = to_simple_string(*d_itr);
     string y_str = d_str.substr(0,4);
@@ -80,6 +84,8 @@ int main(int argc, const char * argv[]) {
       count_good += valid;
       count_broken_good += valid_old_broken;
       count_fixed_good += valid_old_fixed;
+      records.push_back(m209.GetKeyRecord(KeyListIndicator, NetIndicator));
+      records.back().day = d_itr->day_number();
     } else {
       throw runtime_error("File " + key_file + " not found.");
     }
@@ -94,5 +100,9 @@ int main(int argc, const char * argv[]) {
   << " (" << fixed << setprecision(0) << (100.*count_fixed_good)/count << "%)" << endl;
   cout << "Total good drums =             " << count_good <<" / " << count
   << " (" << fixed << setprecision(0) << (100.*count_good)/count << "%)" << endl;
+  if (argc > 1 && !KeyDataBase::Write(argv[1], records)) {
+    cerr << "Unable to write " << argv[1] << endl;
+    return 1;
+  }
   return 0;
 }
@@ -0,0 +1,49 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file CatalogSources.h
+ * \brief NumArrays and drum searches of each machine for hagelin-drumcatalog.
+ * \package hagelin
+ *
+ * M209.h and C52.hpp can't be included in the same file, so each machine
+ * is wrapped in its own file and reached through these functions.
+ */
+
+#ifndef _CATALOGSOURCES_H_
+#define _CATALOGSOURCES_H_
+
+#include <vector>
+using std::vector;
+
+#include "DrumCache.h"
+
+/// NumArrays of Appendix II used by M209::GenKey1944
+vector<DrumCache::NumArrayType> M209CatalogArrays();
+
+/// Search for the good drums of a sorted NumArray with an M209
+DrumCache::Entry M209CatalogSearch(const DrumCache::NumArrayType& NumArray);
+
+/// NumArrays used by C52::GenKey
+vector<DrumCache::NumArrayType> C52CatalogArrays();
+
+/// Search for the good cipher bars of a sorted NumArray with a C52
+DrumCache::Entry C52CatalogSearch(const DrumCache::NumArrayType& NumArray);
+
+#endif // _CATALOGSOURCES_H_
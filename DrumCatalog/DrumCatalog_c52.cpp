@@ -0,0 +1,38 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCatalog_c52.cpp
+ * \brief C52 side of hagelin-drumcatalog.
+ * \package hagelin
+ */
+
+#include "config.h"
+#include "C52.hpp"
+#include "CatalogSources.h"
+
+vector<DrumCache::NumArrayType> C52CatalogArrays() {
+  C52 c52;
+  return c52.NumArrays();
+}
+
+DrumCache::Entry C52CatalogSearch(const DrumCache::NumArrayType& NumArray) {
+  C52 c52;
+  return c52.SearchDrums(NumArray);
+}
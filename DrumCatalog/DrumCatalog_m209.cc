@@ -0,0 +1,37 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCatalog_m209.cc
+ * \brief M209 side of hagelin-drumcatalog.
+ * \package hagelin
+ */
+
+#include "config.h"
+#include "M209.h"
+#include "CatalogSources.h"
+
+vector<DrumCache::NumArrayType> M209CatalogArrays() {
+  return M209::NumArrays();
+}
+
+DrumCache::Entry M209CatalogSearch(const DrumCache::NumArrayType& NumArray) {
+  M209 m209;
+  return m209.SearchDrums(NumArray);
+}
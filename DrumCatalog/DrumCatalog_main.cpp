@@ -0,0 +1,155 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCatalog_main.cpp
+ * \brief Write the catalog of good drums used by m209 and c52 --drumCatalog.
+ * \package hagelin
+ */
+
+#include <iostream>
+using std::cout;
+using std::cerr;
+using std::endl;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <map>
+using std::map;
+#include <thread>
+using std::thread;
+#include <mutex>
+using std::mutex;
+using std::lock_guard;
+#include <atomic>
+using std::atomic;
+#include <algorithm>
+using std::sort;
+#include <boost/program_options.hpp>
+
+bool Quiet = false;
+bool Verbose = false;
+
+#define SOURCE
+#include "config.h"
+#include "DrumCatalog.h"
+#include "CatalogSources.h"
+
+//! Print version.
+//
+void PrintVersion(std::ostream& os) {
+  os << endl;
+  os << "Hagelin drum catalog "
+  << VERSION << " by Joseph Dunn" << endl;
+  os << "Copyright (C) 2019 Joseph Dunn, Released under GPL v3." << endl;
+  os << endl;
+  os << "Joseph Dunn source code hosted at GitHub:" << endl;
+  os << "    https://github.com/JoeDunnStable/hagelin" << endl;
+}
+
+int main(int argc, const char * argv[]) {
+  using namespace boost::program_options;
+  string  FileOut;
+  unsigned Jobs = 1;
+
+  // Parse command-line arguments
+  options_description desc("hagelin-drumcatalog options description");
+  desc.add_options()
+  ("help,h", "produce help message")
+  ("version,V", "print version and copyright")
+  ("fileOut", value<string>(&FileOut), "File name of the catalog to write")
+  (",j", value<unsigned>(&Jobs), "Number of NumArrays to search in parallel.")
+  (",q", bool_switch(&Quiet), "Suppress informational messages.")
+  (",v", bool_switch(&Verbose), "Print verbose debug messages to stderr.");
+
+  variables_map vm;
+  store(parse_command_line(argc, argv, desc), vm);
+  notify(vm);
+
+  if (vm.count("help")) {
+    PrintVersion(cerr);
+    cerr << desc << endl;
+    exit(0);
+  }
+  if (vm.count("version")) {
+    PrintVersion(cerr);
+    exit(0);
+  }
+  if (vm.count("fileOut")==0) {
+    cerr << "Error: The --fileOut option must be specified" << endl;
+    exit(1);
+  }
+  if (Jobs < 1) {
+    cerr << "Error: The -j option must be at least 1" << endl;
+    exit(1);
+  }
+
+  // The M209 drum and the cipher bars of the C52 drum follow the same
+  // rules, so a NumArray used by both machines is searched only once.
+  typedef DrumCache::Entry (*Search)(const DrumCache::NumArrayType&);
+  map<DrumCache::NumArrayType, Search> Pending;
+  for (auto& NumArray : M209CatalogArrays()) {
+    sort(NumArray.begin(), NumArray.end());
+    Pending.insert(std::make_pair(NumArray, &M209CatalogSearch));
+  }
+  for (auto& NumArray : C52CatalogArrays()) {
+    sort(NumArray.begin(), NumArray.end());
+    Pending.insert(std::make_pair(NumArray, &C52CatalogSearch));
+  }
+  vector<std::pair<DrumCache::NumArrayType, Search> > Searches(Pending.begin(), Pending.end());
+
+  map<DrumCache::NumArrayType, vector<DrumCache::Overlaps> > Drums;
+  atomic<size_t> Next{0};
+  mutex DrumsMutex;
+  auto Worker = [&]() {
+    for (size_t i = Next++; i < Searches.size(); i = Next++) {
+      DrumCache::Entry entry = Searches[i].second(Searches[i].first);
+      lock_guard<mutex> lock(DrumsMutex);
+      Drums[Searches[i].first] = entry.overlaps;
+      if (!Quiet) {
+        cout << "Searched " << Drums.size() << " of " << Searches.size()
+             << " NumArrays" << endl;
+      }
+    }
+  };
+
+  vector<thread> Workers;
+  for (unsigned j=1; j<Jobs; ++j) {
+    Workers.push_back(thread(Worker));
+  }
+  Worker();
+  for (auto& w : Workers) {
+    w.join();
+  }
+
+  if (!DrumCatalog::Write(FileOut, Drums)) {
+    cerr << "Unable to write " << FileOut << endl;
+    return 1;
+  }
+  if (!Quiet) {
+    size_t num_drums = 0;
+    for (auto& d : Drums) {
+      num_drums += d.second.size();
+    }
+    cout << "Wrote " << num_drums << " drums for " << Drums.size()
+         << " NumArrays to " << FileOut << endl;
+  }
+  return 0;
+}
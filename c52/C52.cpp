@@ -26,7 +26,6 @@
 *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
 **************************************************************************/
 #include <iostream>
-using std::cerr;
 using std::endl;
 #include <iomanip>
 using std::setfill;
@@ -38,13 +37,14 @@ using std::ifstream;
 using std::stringstream;
 using std::istringstream;
 using std::ostringstream;
-#include <list>
-using std::list;
+#include <algorithm>
+using std::min;
 #include <boost/algorithm/string/split.hpp>
 using boost::algorithm::split;
 using boost::algorithm::token_compress_on;
 #include <boost/algorithm/string/classification.hpp>
 using boost::algorithm::is_alpha;
+#include <boost/algorithm/string/predicate.hpp>
 #include <regex>
 using std::regex;
 using std::smatch;
@@ -52,6 +52,13 @@ using std::regex_match;
 
 #include <config.h>
 #include "C52.hpp"
+#include "CipherKernel.h"
+#include "LetterReader.h"
+
+constexpr int C52::NUM_WHEELS;
+constexpr int C52::NUM_LUG_BARS;
+constexpr const char* C52::KEYFILE_SUFFIX_BIN;
+constexpr const char* C52::KEYDB_SUFFIX;
 
 inline int mod(int a, int b) {
   int ret = a % b;
@@ -110,70 +117,219 @@ const array<vector<string>, 12 >  C52::wheel_labels ={
 
 const array<int, 12> C52::offsets = {-15,-15,-17,-18,-20,-22,-22,-24,-24,-25,-27,-27};
 
+const vector<WheelType>& C52::wheel_types() {
+  static const vector<WheelType> types = [] {
+    vector<WheelType> t;
+    for (size_t j=0; j<wheel_labels.size(); ++j)
+      t.emplace_back(wheel_labels.at(j), offsets.at(j));
+    return t;
+  }();
+  return types;
+}
+
 C52::C52() {
   
+  wheel_idx.fill(0);
+  CheckpointInterval = 0;
+  SearchJobs = 1;
   ClearKey();
 }
 
-char C52::Cipher(char c) {
+void C52::BuildKeyTable(void) {
+  Engine::BuildKeyTable(Drum, KeyTable);
+}
+
+unsigned C52::ReadPins(void) const {
+  unsigned mask = 0;
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    mask |= unsigned(Wheels[i].ReadPinOffset()) << i;
+  }
+  return mask;
+}
+
+template<class Tracer>
+char C52::CipherLetter(char c, Tracer& trace) {
   
   // Check for valid character
   if ((c < 'A') || (c > 'Z')) {
     throw std::invalid_argument("C52::Cipher(): invalid character");
   }
   
-  // Get character number, 0..25
-  int cnum = c - 'A';
-  
   // Get mask of active pins at offsets from current code wheel positions.
-  bitset<NUM_WHEELS> pins;
-  for (size_t i=0; i<NUM_WHEELS; i++) {
-    pins[i] = Wheels.at(i).ReadPinOffset();
-  }
+  unsigned pins = ReadPins();
   
-  // Compare active pins to each lug bar. For each bar where one or
-  // more active lugs match an active pin, add one to the key value.
-  int key = print_offset;
-  for (size_t i=5; i<NUM_LUG_BARS; i++) {
-    key += (Drum.at(i) & pins).any();
-  }
+  // Each cipher bar where one or more active lugs match an active pin
+  // adds one to the key value. KeyTable holds the count for every mask,
+  // together with the wheels that the first five bars step.
+  const Engine::KeyStep& entry = KeyTable[pins];
+  int key = print_offset + entry.key;
   
-  cnum = mod(cnum+key, 26);
+  // Compute ciphered letter from reciprocal alphabet
+  char c2 = Engine::Cipher(c, entry.key, print_offset);
   
   // Increment the letter counter
   ++LetterCounter;
   
-  // Compute ciphered letter from reciprocal alphabet
-  char c2 = 'Z' - cnum;
+  trace.Letter(LetterCounter, pins, c, key, c2);
   
-  if (Verbose) {
-    cerr << "Counter: "
-    << setfill('0') << setw(4) << dec << LetterCounter
-    << "  Wheels: ";
-    for (size_t i=0; i<NUM_WHEELS; i++) {
-      cerr << Wheels.at(i).GetPosName();
+  // Advance first code wheel every time, and wheels 1 to 5 as the first
+  // 5 lugbars determine.
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    if ((entry.step >> i) & 1) {
+      Wheels[i].Step();
     }
-    cerr << "  Pin Positions: ";
-    for (size_t i=0; i<NUM_WHEELS; i++) {
-      cerr << Wheels.at(i).GetOffsetName();
+  }
+  
+  return c2;
+}
+
+char C52::Cipher(char c) {
+  if (Ctx.Verbose) {
+    LetterTrace trace(Wheels, *Ctx.Log, 1);
+    return CipherLetter(c, trace);
+  }
+  NoTrace trace;
+  return CipherLetter(c, trace);
+}
+
+void C52::CipherBuffer(const char* in, size_t length, char* out) {
+  const size_t  chunk = 4096;       // letters per keystream block
+  unsigned char key[chunk];
+  
+  for (size_t n=0; n<length; n++) {
+    if ((in[n] < 'A') || (in[n] > 'Z')) {
+      throw std::invalid_argument("C52::CipherBuffer(): invalid character");
+    }
+  }
+  
+  if (Ctx.Verbose) {
+    // Take the slow path so that every letter is traced.
+    LetterTrace trace(Wheels, *Ctx.Log);
+    for (size_t n=0; n<length; n++) {
+      out[n] = CipherLetter(in[n], trace);
+      if (CheckpointInterval) {
+        RecordCheckpoint();
+      }
+    }
+    return;
+  }
+  
+  // Reduce the print offset so that every key fits the kernel.
+  int offset = mod(print_offset, 26);
+  Engine::WheelState state;
+  state.Load(Wheels);
+  bool cx52 = IsCX52();
+  for (size_t start=0; start<length; ) {
+    size_t  len = min(chunk, length-start);
+    if (CheckpointInterval) {
+      // Stop at the next checkpoint to record it.
+      len = min<uint64_t>(len, CheckpointInterval
+                          - LetterCounter % CheckpointInterval);
+    }
+    if (cx52) {
+      Engine::Keystream<CX52_WHEEL_SIZE>(KeyTable, state, len, key);
+    } else {
+      Engine::Keystream(KeyTable, state, len, key);
+    }
+    Engine::Apply(in+start, key, len, offset, out+start);
+    start += len;
+    LetterCounter += len;
+    if (CheckpointInterval) {
+      state.Store(Wheels);
+      RecordCheckpoint();
+    }
+  }
+  state.Store(Wheels);
+}
+
+bool C52::IsCX52(void) const {
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    if (Wheels[i].GetWheelSize() != CX52_WHEEL_SIZE) {
+      return false;
     }
-    cerr << "  Pin Values: ";
+  }
+  return true;
+}
+
+void C52::FastForward(uint64_t letters) {
+  Engine::WheelState state;
+  state.Load(Wheels);
+  if (IsCX52()) {
+    Engine::Skip<CX52_WHEEL_SIZE>(KeyTable, state, letters);
+  } else {
+    Engine::Skip(KeyTable, state, letters);
+  }
+  state.Store(Wheels);
+  LetterCounter += letters;
+}
+
+void C52::RecordCheckpoint(void) {
+  if (LetterCounter % CheckpointInterval ||
+      LetterCounter / CheckpointInterval != Checkpoints.Positions.size()) {
+    return;
+  }
+  array<int, NUM_WHEELS> pos;
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    pos[i] = Wheels[i].GetPosition();
+  }
+  Checkpoints.Positions.push_back(pos);
+}
+
+void C52::StartCheckpoints(void) {
+  Checkpoints.Interval = CheckpointInterval;
+  Checkpoints.PrintOffset = print_offset;
+  Checkpoints.Positions.clear();
+  LetterCounter = 0;
+  if (CheckpointInterval) {
+    RecordCheckpoint();
+  }
+}
+
+void C52::Seek(uint64_t letterIndex, const CheckpointTable& checkpoints) {
+  if (checkpoints.Interval == 0 || checkpoints.Positions.empty()) {
+    throw std::invalid_argument("C52::Seek(): no checkpoints");
+  }
+  uint64_t n = min<uint64_t>(letterIndex / checkpoints.Interval,
+                             checkpoints.Positions.size() - 1);
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    Wheels[i].SetPosition(checkpoints.Positions[n][i]);
+  }
+  print_offset = checkpoints.PrintOffset;
+  LetterCounter = n * checkpoints.Interval;
+  FastForward(letterIndex - n * checkpoints.Interval);
+}
+
+void C52::CheckpointTable::Write(ostream& os) const {
+  os << "C52CHECKPOINTS " << Interval << " " << PrintOffset << " "
+     << Positions.size() << endl;
+  for (size_t n=0; n<Positions.size(); n++) {
+    os << n * Interval;
     for (size_t i=0; i<NUM_WHEELS; i++) {
-      cerr << pins[i];
+      os << " " << Positions[n][i];
     }
-    cerr << "  In: " << c
-    << "  Key: " << setfill(' ') << setw(2) << key
-    << "  Out: " << c2;
-    cerr << endl;
+    os << endl;
   }
-  // Advance first code wheel every time.
-  Wheels.at(0).Rotate(1);
-  for (size_t i=1; i<NUM_WHEELS; i++) {
-    // Use the first 5 lugbars to determine advance of wheels 1 to 5
-    Wheels.at(i).Rotate((Drum.at(i-1) & pins).any() ? 1 : 0);
+}
+
+void C52::CheckpointTable::Read(istream& is) {
+  string magic;
+  size_t count = 0;
+  if (!(is >> magic >> Interval >> PrintOffset >> count)
+      || magic != "C52CHECKPOINTS" || Interval == 0) {
+    throw std::runtime_error("Not a checkpoint table");
+  }
+  Positions.resize(count);
+  for (size_t n=0; n<count; n++) {
+    uint64_t letter;
+    if (!(is >> letter) || letter != n * Interval) {
+      throw std::runtime_error("Bad checkpoint table");
+    }
+    for (size_t i=0; i<NUM_WHEELS; i++) {
+      if (!(is >> Positions[n][i])) {
+        throw std::runtime_error("Bad checkpoint table");
+      }
+    }
   }
-  
-  return c2;
 }
 
 void C52::ClearKey(void) {
@@ -184,6 +340,7 @@ void C52::ClearKey(void) {
       Drum.at(i)[j] = false;
     }
   }
+  BuildKeyTable();
   LetterCounter = 0;
 }
 
@@ -270,13 +427,16 @@ void C52::ExportKey(const string& NetIndicator, date d, ostream& os) {
 
 bool C52::LoadKey(const string& fname, string &NetIndicator, date d) {
 
-  if (Verbose) {
-    cerr << "Looking for key file " << fname << endl;
+  if (boost::algorithm::ends_with(fname, KEYFILE_SUFFIX_BIN)) {
+    return LoadBinaryKey(fname, NetIndicator, d);
+  }
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Looking for key file " << fname << endl;
   }
   ifstream keyfile(fname, ifstream::in); // key file input stream
   if (!keyfile) return false;
-  if (!Quiet) {
-    cerr << "Loading key file " << fname << endl;
+  if (!Ctx.Quiet) {
+    *Ctx.Log << "Loading key file " << fname << endl;
   }
   LoadKey(keyfile, NetIndicator, d);
   return true;
@@ -287,17 +447,49 @@ bool C52::LoadKey(date d, string& NetIndicator) {
   if (getenv("C52_KEYLIST_DIR") != nullptr)
     root_dir = getenv("C52_KEYLIST_DIR");
   else {
-    cerr << "ERROR: Environmental variable C52_KEYLIST_DIR must be defined to";
-    cerr << " use the -A mode." << endl;
-    exit(1);
+    throw std::runtime_error("Environmental variable C52_KEYLIST_DIR must be defined"
+                             " to use the -A mode.");
   }
   if (root_dir.back() != '/')
     root_dir += "/";
-  string d_str = to_iso_string(d);
-  string key_file = NetIndicator + "/" + d_str + ".c52key";
-  bool ret = LoadKey(root_dir + key_file, NetIndicator, d);
-  if (!ret) {
-    cerr << "Could not load key from file " << (root_dir + key_file) << endl;
+  KeyCache<KeyState>::Key key{KeyRecord::C52, root_dir, NetIndicator,
+                              d.day_number()};
+  KeyState state;
+  if (KeyListCache.Lookup(key, state)) {
+    if (Ctx.Verbose) {
+      *Ctx.Log << "Using cached key for " << NetIndicator << " " << d << endl;
+    }
+    wheel_idx = state.wheel_idx;
+    Wheels = state.wheels;
+    Drum = state.drum;
+    BuildKeyTable();
+    LetterCounter = 0;
+    return true;
+  }
+  bool ret;
+  string db_file = root_dir + NetIndicator + KEYDB_SUFFIX;
+  if (ifstream(db_file)) {
+    if (!Ctx.Quiet) {
+      *Ctx.Log << "Loading key from data base " << db_file << endl;
+    }
+    KeyDataBase db(db_file);
+    const KeyRecord* record = db.Find(d.day_number());
+    ret = record != nullptr;
+    if (ret) {
+      SetKeyRecord(*record);
+    } else {
+      *Ctx.Log << "No key for " << d << " in " << db_file << endl;
+    }
+  } else {
+    string d_str = to_iso_string(d);
+    string key_file = NetIndicator + "/" + d_str + ".c52key";
+    ret = LoadKey(root_dir + key_file, NetIndicator, d);
+    if (!ret) {
+      *Ctx.Log << "Could not load key from file " << (root_dir + key_file) << endl;
+    }
+  }
+  if (ret) {
+    KeyListCache.Insert(key, KeyState{wheel_idx, Wheels, Drum});
   }
   return ret;
 }
@@ -305,16 +497,16 @@ bool C52::LoadKey(date d, string& NetIndicator) {
 void C52::LoadKey(istream& keyfile, string& NetIndicator, date d) {
   ClearKey();
   
-  if (Verbose) {
-    cerr << "Reading key file " << endl;
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Reading key file " << endl;
   }
   
   // Read key file one line at a time
   string line;
   getline(keyfile, line);  // Line of ---...
   getline(keyfile, line);
-  if (!Quiet) {
-    cerr << "Description: " << line << endl;
+  if (!Ctx.Quiet) {
+    *Ctx.Log << "Description: " << line << endl;
   }
   getline(keyfile, line);  // line of ---
   getline(keyfile, line);  // line with wheel sizes NR and lug heading
@@ -347,11 +539,7 @@ void C52::LoadKey(istream& keyfile, string& NetIndicator, date d) {
       oss << "C52::LoadKey: Unable to find wheel of size " << wheel_size.at(i);
       throw std::runtime_error(oss.str());
     }
-    Wheels.at(i).Clear();
-    for (auto a : wheel_labels.at(wheel_idx.at(i))) {
-      Wheels.at(i).AddPosition(a);
-    }
-    Wheels[i].SetReadOffset(offsets.at(wheel_idx.at(i)));
+    Wheels.at(i).SetType(wheel_types().at(wheel_idx.at(i)));
 
   }
   getline(keyfile, line);  // Line of ---
@@ -407,16 +595,17 @@ void C52::LoadKey(istream& keyfile, string& NetIndicator, date d) {
       }
     }
   } // for i
+  BuildKeyTable();
   getline(keyfile, line);  // Should be line of ---
   if (!getline(keyfile, line) || line.size() == 0) {
-    if (!Quiet) {
-      cerr << "C52::LoadKey: No 25 letter check is present." << endl;
+    if (!Ctx.Quiet) {
+      *Ctx.Log << "C52::LoadKey: No 25 letter check is present." << endl;
     }
     // No check
     return;
   }
-  if (Verbose) {
-    cerr << "  letter check line \"" << line << "\"" << endl;
+  if (Ctx.Verbose) {
+    *Ctx.Log << "  letter check line \"" << line << "\"" << endl;
   }
 
   // Reassemble check line without group spacing
@@ -426,8 +615,8 @@ void C52::LoadKey(istream& keyfile, string& NetIndicator, date d) {
       check_line.push_back(line[i]);
   }
   
-  if (Verbose) {
-    cerr << "Running 25 letter check" << endl;
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Running 25 letter check" << endl;
   }
   
   string test_line;
@@ -450,42 +639,98 @@ void C52::LoadKey(istream& keyfile, string& NetIndicator, date d) {
   }
 }
 
-void C52::ResetCounter(void) {
+KeyRecord C52::GetKeyRecord(const string& NetIndicator, date d) const {
+  KeyRecord record = KeyRecord();
   
-  LetterCounter = 0;
+  record.machine = KeyRecord::C52;
+  record.bars = NUM_LUG_BARS;
+  record.SetNetIndicator(NetIndicator);
+  record.day = d.is_special() ? 0 : d.day_number();
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    record.wheel_idx[i] = wheel_idx.at(i);
+    record.pins[i] = Wheels.at(i).GetPins();
+  }
+  for (size_t i=0; i<NUM_LUG_BARS; i++) {
+    record.lugs[i] = Drum.at(i).to_ulong();
+  }
+  return record;
 }
 
 
-bool C52::SetWheels(vector<string> indicator) {
-  size_t i,j;
-  for (i=0, j=0; (i<NUM_WHEELS) && (j < indicator.size()); i++, j++) {
-    try {
-      if (Verbose) {
-        cerr << "Trying wheel "
-        << dec << i
-        << " setting "
-        << indicator[j]
-        << endl;
-      }
-      Wheels[i].SetPosByName(indicator[j]);
-    } catch (...) {
-      // reset counters to force retry with next indicator value
-      --i;
+void C52::SetKeyRecord(const KeyRecord& record) {
+  if (record.machine != KeyRecord::C52 || record.bars != NUM_LUG_BARS) {
+    throw std::invalid_argument("C52::SetKeyRecord(): not a C52 key");
+  }
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    if (record.wheel_idx[i] >= wheel_labels.size()) {
+      throw std::invalid_argument("C52::SetKeyRecord(): bad wheel index");
     }
   }
+  for (size_t i=0; i<NUM_LUG_BARS; i++) {
+    if (record.lugs[i] >> NUM_WHEELS) {
+      throw std::invalid_argument("C52::SetKeyRecord(): bad lug bar");
+    }
+    Drum.at(i) = bitset<NUM_WHEELS>(record.lugs[i]);
+  }
+  BuildKeyTable();
+  for (size_t i=0; i<NUM_WHEELS; i++) {
+    wheel_idx.at(i) = record.wheel_idx[i];
+    Wheels.at(i).SetType(wheel_types().at(wheel_idx.at(i)));
+    Wheels.at(i).SetPins(record.pins[i]);
+    Wheels.at(i).SetPosition(0);
+  }
+  print_offset = 0;
+  LetterCounter = 0;
+}
+
+
+bool C52::LoadBinaryKey(const string& fname, string& NetIndicator, date& d) {
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Looking for key file " << fname << endl;
+  }
+  if (!ifstream(fname)) return false;
+  if (!Ctx.Quiet) {
+    *Ctx.Log << "Loading key file " << fname << endl;
+  }
+  KeyFile keyfile(fname);
+  const KeyRecord& record = keyfile.Record();
+  SetKeyRecord(record);
+  if (record.net[0] != 0) {
+    NetIndicator = record.NetIndicator();
+  }
+  if (record.day != 0) {
+    d = date(gregorian_calendar::from_day_number(record.day));
+  }
+  return true;
+}
+
+
+bool C52::SaveBinaryKey(const string& fname, const string& NetIndicator,
+                        date d) const {
+  return KeyFile::Write(fname, GetKeyRecord(NetIndicator, d));
+}
+
+
+void C52::ResetCounter(void) {
   
-  if (i < NUM_WHEELS) {
-    // Unable to set wheels as requested
+  LetterCounter = 0;
+}
+
+
+bool C52::SetWheels(const vector<string>& indicator) {
+  if (!Engine::SetPositions(Wheels, indicator, Ctx)) {
     return false;
   }
-  
-  if (Verbose) {
-    cerr << "Wheels set to: ";
-    for (i=0; i<NUM_WHEELS; i++) {
-      cerr << Wheels[i].GetPosName();
-    }
-    cerr << endl;
+  LetterCounter = 0;
+  return true;
+}
+
+
+bool C52::TrySetPositions(const char* const* names, size_t count) {
+  if (!Engine::TrySetPositions(Wheels, names, count, Ctx)) {
+    return false;
   }
+  LetterCounter = 0;
   return true;
 }
 
@@ -495,11 +740,15 @@ void C52::CipherStream(bool AutoKey,
                         string& NetIndicator,
                         string KeyDir,
                         bool CipherMode,
-                        istream& InText, ostream& OutText) {
+                        istream& InText, ostream& OutText,
+                        bool Streaming) {
   
   // Output is buffered in OutBuf so that we can insert group count at
   // beginning of buffer after generating ciphertext if needed. This is
-  // a bit of a kludge, but it works.
+  // a bit of a kludge, but it works. In streaming mode the output goes
+  // straight to OutText and the group count is left out.
+  stringstream OutBuf;
+  ostream& Out = Streaming ? OutText : OutBuf;
   
   
   // Prepare message indicator array;
@@ -519,64 +768,36 @@ void C52::CipherStream(bool AutoKey,
   "([0-9]+)"            // group count
   "[\\s]*";             // optional trailing whitespace
   
-  // Read entire input message into buffer. If we are deciphering
-  // with automatic indicator extraction, we will look for repeated
-  // message indicators at end of message, and snip them off.
-  list<char> MsgText;
-  while (InText.good()) {
-    // Read a line
-    string line;
-    getline(InText, line);
-    
-    // upcase it
-    boost::to_upper(line);
-    
-    if (Verbose) {
-      cerr << "read message line \"" << line << "\"" << endl;
-    }
-    
-    // If decipher mode get NetIndicator and date.
-    bool FoundNetInd = false;
-    if (!CipherMode && !FoundNetInd) {
+  // Read the input a chunk at a time. If decipher mode get NetIndicator
+  // and date from the first line that looks like a net indicator line.
+  LetterReader::LineFilter NetIndFilter;
+  if (!CipherMode) {
+    NetIndFilter = [&](const string& line) {
       smatch matches;
-      if (regex_match(line, matches, netind_regex)) {
-        // Line looks like a net indicator line.
-        if (AutoKey) {
-          NetIndicator = matches[1].str();
-          d = from_simple_string(matches[2].str());
-          if (Verbose) {
-            cerr << "Using NetIndicator \"" << NetIndicator << "\"" <<
-            ", and date " << to_simple_string(d) << " from cipher text" << endl;
-          }
-        } else {
-          if (Verbose) {
-            cerr << "Discarding net indicator line \"" << line << "\"" << endl;
-          }
+      if (!regex_match(line, matches, netind_regex))
+        return false;
+      // Line looks like a net indicator line.
+      if (AutoKey) {
+        NetIndicator = matches[1].str();
+        d = from_simple_string(matches[2].str());
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Using NetIndicator \"" << NetIndicator << "\"" <<
+          ", and date " << to_simple_string(d) << " from cipher text" << endl;
+        }
+      } else {
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Discarding net indicator line \"" << line << "\"" << endl;
         }
-        FoundNetInd = true;
-        continue;
-      }
-    }
-    
-    // Now copy the line into the message buffer, processing
-    // it char by char
-    for (string::iterator i=line.begin(); i < line.end(); i++) {
-      char InC = *i;
-      
-      // When enciphering, translate space to X
-      if (CipherMode && (InC == ' ')) {
-        InC = 'X';
-      }
-      
-      // Ignore if not alphabetic
-      if (isalpha(InC)) {
-        MsgText.push_back(InC);
       }
-      
-    }
+      return true;
+    };
   }
+  // When enciphering, translate space to X
+  LetterReader Reader(InText, CipherMode ? 'X' : 0, NetIndFilter);
+  string MsgText;         // Letters read but not yet processed
+  bool More = Reader.Fill(MsgText, LetterReader::CHUNK);
+  size_t MsgBegin = 0;    // Start of the part of MsgText still to be processed
   
-  stringstream OutBuf;
   // Are we automatically setting message indicators?
   if (AutoMsgIndicator) {
     
@@ -589,16 +810,16 @@ void C52::CipherStream(bool AutoKey,
       if (AutoKey) {
         d = day_clock::universal_day();
         if (!LoadKey(d, NetIndicator)) {
-          cerr << "ERROR: Unable to load key data base " << endl;
-          exit(1);
+          throw std::runtime_error("Unable to load key data base");
         }
       } else {
+        string Keyfile0 = KeyDir + "/" + to_iso_string(d) + KEYFILE_SUFFIX_BIN;
         string Keyfile = KeyDir + "/" + to_iso_string(d) + KEYFILE_SUFFIX;
 
-        if (LoadKey(Keyfile, NetIndicator, d)) {
-        } else if (!Quiet) {
-          cerr << "ERROR: Key file" + Keyfile +" not found." << endl;
-          exit(1);
+        if (LoadKey(Keyfile0, NetIndicator, d)) {
+        } else if (LoadKey(Keyfile, NetIndicator, d)) {
+        } else if (!Ctx.Quiet) {
+          throw std::runtime_error("Key file " + Keyfile + " not found.");
         }
       }
 
@@ -631,8 +852,10 @@ void C52::CipherStream(bool AutoKey,
       print_offset=0;
       // We need to reset the wheel positions to encrypt the starting pos
       for (size_t i=0; i<NUM_WHEELS; ++i) {
-        string pos{IntMsgInd.at(i)};
-        Wheels.at(i).SetPosByName(pos);
+        const char pos[] = {IntMsgInd.at(i), 0};
+        if (!Wheels.at(i).TrySetPosByName(pos)) {
+          throw std::runtime_error("Invalid external message indicator.");
+        }
       }
       for (size_t i=NUM_WHEELS; i<2*NUM_WHEELS; ++i) {
         ExtMsgInd.at(i) = Cipher(IntMsgInd.at(i));
@@ -648,8 +871,10 @@ void C52::CipherStream(bool AutoKey,
       ExtMsgInd.at(14) = Cipher(IntMsgInd.at(14));
       
       for (size_t i=0; i<NUM_WHEELS; ++i) {
-        string pos{IntMsgInd.at(i+NUM_WHEELS)};
-        Wheels.at(i).SetPosByName(pos);
+        const char pos[] = {IntMsgInd.at(i+NUM_WHEELS), 0};
+        if (!Wheels.at(i).TrySetPosByName(pos)) {
+          throw std::runtime_error("Invalid internal message indicator.");
+        }
       }
       print_offset=p_offset;
       
@@ -658,9 +883,9 @@ void C52::CipherStream(bool AutoKey,
       // Print system indicator, external message indicator
       // and key list indicator
       for (size_t i=0; i<ExtMsgInd.size(); i++) {
-        OutBuf << ExtMsgInd[i];
+        Out << ExtMsgInd[i];
         if (((i+1) % 5) == 0) {
-          OutBuf << ' ';
+          Out << ' ';
         }
       }
       
@@ -669,18 +894,18 @@ void C52::CipherStream(bool AutoKey,
       
       if (AutoKey) {
         if (!LoadKey(d, NetIndicator)) {
-          cerr << "ERROR: Unable to load key from data base" << endl;
-          exit(1);
+          throw std::runtime_error("Unable to load key from data base");
         }
       } else {
         // See if corresponding key file exists
-        // Try .txt extension first, then .m209key if not found.
+        // Try the binary key first, then .c52key if not found.
+        string Keyfile0 = KeyDir + "/" + to_iso_string(d) + KEYFILE_SUFFIX_BIN;
         string Keyfile = KeyDir + "/" + to_iso_string(d) + KEYFILE_SUFFIX;
 
-        if (LoadKey(Keyfile, NetIndicator, d)) {
+        if (LoadKey(Keyfile0, NetIndicator, d)) {
+        } else if (LoadKey(Keyfile, NetIndicator, d)) {
         } else {
-          cerr << "ERROR: Key file not found." << endl;
-          exit(1);
+          throw std::runtime_error("Key file not found.");
         }
 
       }
@@ -689,43 +914,44 @@ void C52::CipherStream(bool AutoKey,
       // First, check for valid message indicator at each
       // end of message.
       
-      if (MsgText.size() < 15) {
+      if (!More && MsgText.size() < 15) {
         // Message is too small for message indicators
         // plus at least one 5-letter group.
-        cerr << "ERROR: Message is too small."
-        << endl;
-        exit(1);
+        throw std::runtime_error("Message is too small.");
       }
       for (size_t i=0; i<ExtMsgInd.size(); i++) {
-        ExtMsgInd.at(i) = MsgText.front();
-        MsgText.pop_front();
+        ExtMsgInd.at(i) = MsgText[MsgBegin++];
       }
-      if (Verbose) {
-        cerr << "ExtMsgInd = \"";
+      if (Ctx.Verbose) {
+        *Ctx.Log << "ExtMsgInd = \"";
         for (size_t i=0; i<ExtMsgInd.size(); i++) {
-          cerr << ExtMsgInd.at(i);
+          *Ctx.Log << ExtMsgInd.at(i);
         }
-        cerr << "\"" << endl;
+        *Ctx.Log << "\"" << endl;
       }
       
       print_offset = 0;
       // Extract message indicator components
       for (size_t i=0; i<NUM_WHEELS; ++i) {
-        string pos{ExtMsgInd.at(i)};
-        Wheels.at(i).SetPosByName(pos);
+        const char pos[] = {ExtMsgInd.at(i), 0};
+        if (!Wheels.at(i).TrySetPosByName(pos)) {
+          throw std::runtime_error("Invalid external message indicator.");
+        }
       }
       for (size_t i=NUM_WHEELS; i< 2*NUM_WHEELS+3; ++i) {
         IntMsgInd.at(i) = Cipher(ExtMsgInd.at(i));
       }
-      if (Verbose) {
-        cerr << "IntMsgInd = \"";
+      if (Ctx.Verbose) {
+        *Ctx.Log << "IntMsgInd = \"";
         for (size_t i=NUM_WHEELS; i<IntMsgInd.size(); ++i)
-          cerr << IntMsgInd.at(i);
-        cerr << "\"" << endl;
+          *Ctx.Log << IntMsgInd.at(i);
+        *Ctx.Log << "\"" << endl;
       }
       for (size_t i=0; i<NUM_WHEELS; ++i) {
-        string pos{IntMsgInd.at(i+NUM_WHEELS)};
-        Wheels.at(i).SetPosByName(pos);
+        const char pos[] = {IntMsgInd.at(i+NUM_WHEELS), 0};
+        if (!Wheels.at(i).TrySetPosByName(pos)) {
+          throw std::runtime_error("Invalid internal message indicator.");
+        }
       }
       print_offset = IntMsgInd.at(14) - 'A';
       
@@ -735,32 +961,52 @@ void C52::CipherStream(bool AutoKey,
     } // decipher
   } // if AutoMsgIndicator
   
-  while (!MsgText.empty()) {
-    char InC = MsgText.front();
-    MsgText.pop_front();
-    
-    // Process the character
-    char OutC = Cipher(InC);
-    
-    // In decipher mode, convert X to space
-    if (!CipherMode && (OutC == 'X')) {
-      OutC = ' ';
+  if (CheckpointInterval) {
+    StartCheckpoints();
+  }
+  
+  // Process the message a chunk at a time
+  string CipherText;
+  uint64_t Count = LetterCounter;  // letter counter for each output letter
+  string Formatted;
+  for (;;) {
+    CipherText.resize(MsgText.size() - MsgBegin);
+    if (!CipherText.empty()) {
+      CipherBuffer(&MsgText[MsgBegin], CipherText.size(), &CipherText[0]);
     }
+    MsgText.clear();
+    MsgBegin = 0;
     
-    // Output the character
-    OutBuf << OutC;
-    
-    // Add a space or line break every five letters in encipher mode.
-    if (CipherMode && LetterCounter && (LetterCounter % 5 == 0)) {
+    Formatted.clear();
+    for (string::iterator i=CipherText.begin(); i < CipherText.end(); i++) {
+      char OutC = *i;
+      ++Count;
       
-      // Break line every 25 letters, also counting the initial 10 letter
-      // message indicator when appropriate.
-      if (((LetterCounter + ((AutoMsgIndicator && CipherMode)?15:0)) % 25) == 0) {
-        OutBuf << endl;
-      } else {
-        OutBuf << ' ';
+      // In decipher mode, convert X to space
+      if (!CipherMode && (OutC == 'X')) {
+        OutC = ' ';
+      }
+      
+      // Output the character
+      Formatted.push_back(OutC);
+      
+      // Add a space or line break every five letters in encipher mode.
+      if (CipherMode && Count && (Count % 5 == 0)) {
+        
+        // Break line every 25 letters, also counting the initial 10 letter
+        // message indicator when appropriate.
+        if (((Count + ((AutoMsgIndicator && CipherMode)?15:0)) % 25) == 0) {
+          Formatted.push_back('\n');
+        } else {
+          Formatted.push_back(' ');
+        }
       }
     }
+    Out << Formatted;
+    
+    if (!More)
+      break;
+    More = Reader.Fill(MsgText, LetterReader::CHUNK);
   }
   
   if (AutoMsgIndicator && CipherMode) {
@@ -768,17 +1014,17 @@ void C52::CipherStream(bool AutoKey,
     // Pad out message if necessary with unenciphered 'X's
     if (LetterCounter % 5) {
       while (LetterCounter % 5) {
-        if (Verbose) {
-          cerr << "Padding with unenciphered X" << endl;
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Padding with unenciphered X" << endl;
         }
-        OutBuf << 'X';
+        Out << 'X';
         ++LetterCounter;
       }
       
       if (((LetterCounter + 15) % 25) == 0) {
-        OutBuf << endl;
+        Out << endl;
       } else {
-        OutBuf << ' ';
+        Out << ' ';
       }
     }
     
@@ -801,8 +1047,9 @@ void C52::CipherStream(bool AutoKey,
  */
     
     // If NetIndicator is not empty, then add net indicator
-    // and group count at beginning of output buffer.
-    if (!NetIndicator.empty()) {
+    // and group count at beginning of output buffer. In streaming mode
+    // the beginning has already been written.
+    if (!NetIndicator.empty() && !Streaming) {
       string tempbuf  = OutBuf.str();
       OutBuf.clear();
       OutBuf.str(std::string());
@@ -814,7 +1061,10 @@ void C52::CipherStream(bool AutoKey,
     
   }
   
-  OutBuf << endl;
+  Out << endl;
+  
+  if (Streaming)
+    return;
   
   // Finally, send buffered output to output stream.
   OutText << OutBuf.str();
@@ -33,15 +33,27 @@
 using std::vector;
 #include <array>
 using std::array;
+#include <cstdint>
 #include <string>
 using std::string;
 
 #include <bitset>
 using std::bitset;
+#include <atomic>
+#include <mutex>
+#include <memory>
 #include <boost/date_time/gregorian/gregorian.hpp>
 using namespace boost::gregorian;
 
 #include "C52Keywheel.hpp"
+#include "DrumCache.h"
+#include "KeyRecord.h"
+#include "KeyCache.h"
+#include "Context.h"
+#include "Trace.h"
+#include "HagelinMachine.h"
+
+class DrumCatalog;
 
 #include <iostream>
 using std::cout;
@@ -50,12 +62,6 @@ using std::istream;
 #include <vector>
 #include <array>
 
-//! Number of pin wheels.
-#define NUM_WHEELS  6
-
-//! Number of lug bars in drum.
-#define NUM_LUG_BARS  32
-
 //! This defines how hard we are willing to work ar generating a key.
 //
 #define GUMPTION 1000
@@ -64,27 +70,69 @@ using std::istream;
 //
 #define KEYFILE_SUFFIX ".c52key"  // alternate extension for backwards compatibility
 
+//! Size of the wheels of a CX-52, all six of which are alike.
+//
+#define CX52_WHEEL_SIZE 47
+
 
 extern bool Verbose;
 extern bool Quiet;
 
 
-/// struct with lug bars together iwth a score for their fit with Appendix II of the
-/// Technical Manual
-struct ScoredDrum {
-  array<bitset<NUM_WHEELS>, NUM_LUG_BARS> drum;
-  int score;
-  friend bool operator< (const ScoredDrum& lhs, const ScoredDrum& rhs)
-    {return lhs.score < rhs.score;}
-};
-
 
 //! This class simulates an C52 series cipher machine.
 //
 class C52 {
 public:
   
-  typedef array<bitset<NUM_WHEELS>, NUM_LUG_BARS> DrumType;
+  //! Number of pin wheels.
+  static constexpr int NUM_WHEELS = 6;
+  
+  //! Number of lug bars in drum.
+  static constexpr int NUM_LUG_BARS = 32;
+  
+  //! Suffix of a binary key file, written with --binaryKey
+  static constexpr const char* KEYFILE_SUFFIX_BIN = ".c52bin";
+  
+  //! Suffix of the key data base of a net in C52_KEYLIST_DIR
+  static constexpr const char* KEYDB_SUFFIX = ".c52db";
+  
+  /// The cipher engine: 32 bars, the first 5 of which step the wheels, and
+  /// an additive key
+  typedef HagelinMachine<NUM_LUG_BARS, NUM_WHEELS, BarStep, AdditiveKey> Engine;
+  
+  typedef Engine::DrumType DrumType;
+  
+  /// struct with lug bars together iwth a score for their fit with Appendix II of the
+  /// Technical Manual
+  struct ScoredDrum {
+    DrumType drum;
+    int score;
+    friend bool operator< (const ScoredDrum& lhs, const ScoredDrum& rhs)
+      {return lhs.score < rhs.score;}
+  };
+  
+  /// Least number of the best drums GenKey picks a drum from
+  static const int NUM_CANDIDATES = 25;
+  
+  /// Wheel positions recorded every Interval letters of a message, so that
+  /// deciphering can resume at any letter from the nearest checkpoint
+  /// instead of from the start of the message.
+  struct CheckpointTable {
+    uint64_t Interval = 0;
+    int PrintOffset = 0;
+    /// Positions[n] holds the wheel positions before letter n*Interval
+    vector<array<int, NUM_WHEELS> > Positions;
+    
+    /// Write the table as text, a header line and then one line with the
+    /// letter and the wheel positions per checkpoint
+    void Write(ostream& os) const;
+    
+    /// Read a table written by Write. Throws std::runtime_error if the
+    /// input isn't a checkpoint table.
+    void Read(istream& is);
+  };
+  
   
 private:
   
@@ -102,8 +150,54 @@ private:
   int print_offset;
   
   //! Letter counter (a 4-digit counter in a real machine).
+  
+  //! Counts every letter since the counter was last zero, so checkpoints
+  //! and seeking work however long the message.
+  //
+  uint64_t     LetterCounter;
+  
+  //! Verbosity and log stream used when loading keys and ciphering.
+  //
+  Context      Ctx;
+  
+  /// Letters between checkpoints recorded by CipherBuffer, 0 for none
+  uint64_t     CheckpointInterval;
+  
+  /// Checkpoints of the current message
+  CheckpointTable Checkpoints;
+  
+  /// Record a checkpoint if the letter counter is at the next one
+  void RecordCheckpoint(void);
+  
+  //! KeyStep for each of the 64 possible pin masks.
+  
+  //! Bit i of the index is the pin read from wheel i. Rebuilt by
+  //! BuildKeyTable() whenever the drum changes.
+  //
+  Engine::KeyStepTable KeyTable;
+  
+  //! Recompute KeyTable from the current drum.
+  //
+  void BuildKeyTable(void);
+  
+  //! Mask of the pins currently read from the wheels, bit i for wheel i.
+  //
+  unsigned ReadPins(void) const;
+  
+  //! True if all the wheels are the size of those of a CX-52, so that the
+  //! engine can use its fast path for CX52_WHEEL_SIZE.
   //
-  int          LetterCounter;
+  bool IsCX52(void) const;
+  
+  //! Trace of the letters ciphered in verbose mode
+  //
+  typedef Trace<array<C52Keywheel, NUM_WHEELS>, NUM_WHEELS> LetterTrace;
+  
+  //! Encipher/Decipher one letter, passing it to trace, a NoTrace or a
+  //! LetterTrace.
+  //
+  template<class Tracer>
+  char CipherLetter(char c, Tracer& trace);
   
   /// The NumArrays contained in Appendix II Group A of the 1944 Tecnical
   /// Manual. Group A are the arrays without repeats.
@@ -112,12 +206,59 @@ private:
   /// the array in Appendix II Group B of the 1944 Technical Manual
   /// These are the arrays with one repeat.
   static vector<array<int,NUM_WHEELS> > NumArrayB;
+  
+  /// Ensures that GenKey generates the NumArrays only once, even when
+  /// C52 objects on several threads generate keys at the same time.
+  static std::once_flag NumArraysFlag;
   static const array<vector<string>, 12 > wheel_labels;
   static const array<int, 12> offsets;
+  /// The twelve wheel types made from wheel_labels and offsets, built
+  /// on first use and shared by every C52
+  static const vector<WheelType>& wheel_types();
+  
+  /// Put the deterministic stepping lugs on the first NUM_WHEELS-1 bars
+  /// of drum: bar j has lugs on wheels 0 to j.
+  static void SetSteppingBars(DrumType& drum);
+  
+  /// Put the stepping bars and the lugs given by NumArray and the overlaps
+  /// on a drum
+  ScoredDrum MakeDrum(const array<int, NUM_WHEELS>& NumArray,
+                      const DrumCache::Overlaps& overlaps);
+  
+  /// Precomputed good drums used by GenKey in place of GoodDrums, if loaded
+  static std::shared_ptr<const DrumCatalog> Catalog;
+  
+  /// Set Drum to one of the best drums in Catalog for NumArray. Returns
+  /// 1 if it did, 0 if the catalog has no good drum for NumArray, and -1
+  /// if NumArray isn't in the catalog.
+  int CatalogDrum(const array<int, NUM_WHEELS>& NumArray);
+  
+  /// Number of NumArrays GenKey searches at once, on separate threads
+  unsigned SearchJobs;
 
 
 public:
   
+  /// Good drums found so far, shared by all C52 objects. May be saved to
+  /// a file and loaded again to skip the searches in a later run.
+  static DrumCache DrumSearchCache;
+  
+  /// Wheels and drum of a key loaded from the keylist data base
+  struct KeyState {
+    array<size_t, NUM_WHEELS> wheel_idx;
+    array<C52Keywheel, NUM_WHEELS> wheels;
+    DrumType drum;
+  };
+  
+  /// Keys loaded by LoadKey(date, ...), shared by all C52 objects, so that
+  /// messages on the same key don't read the key list again.
+  static KeyCache<KeyState> KeyListCache;
+  
+  /// Map a drum catalog written by hagelin-drumcatalog. GenKey then picks
+  /// drums from it instead of searching. Throws std::runtime_error if the
+  /// file isn't a valid catalog.
+  static void LoadDrumCatalog(const string& fname);
+  
   //! Default constructor.
   //
   C52();
@@ -128,11 +269,33 @@ public:
   ~C52() {}
   
   
+  //! Set the verbosity and log stream of this machine.
+  //
+  void SetContext(const Context& context) {
+    Ctx = context;
+  }
+  
+  //! The verbosity and log stream of this machine.
+  //
+  const Context& GetContext(void) const {
+    return Ctx;
+  }
+  
+  
   //! Encipher/Decipher one letter.
   //
   char Cipher(char c);
   
   
+  //! Encipher/Decipher length letters from in to out.
+  
+  //! Equivalent to calling Cipher() on each letter. The key values are
+  //! computed first and then applied in bulk with CipherKernel. Wheels
+  //! and letter counter are advanced by length.
+  //
+  void CipherBuffer(const char* in, size_t length, char* out);
+  
+  
   //! Clear current key settings.
   //
   void ClearKey(void);
@@ -151,55 +314,137 @@ public:
   /// Load key from file using indicated KeyListIndicator and NetIndicator
   bool LoadKey(const string& fname, string& NetIndicator, date d);
       
-  /// Load key from database based on date and NetIndicator
+  /// Load key from database based on date and NetIndicator. The packed
+  /// data base of the net is used if there is one, else the key file of
+  /// the day.
       bool LoadKey(date d, string& NetIndicator);
   
   /// Load key for an istream using designated KeyListIndicator and NetIndicator
   void LoadKey(istream& keyfile, string& NetIndicator, date d);
   
+  /// Return the current key as a KeyRecord
+  KeyRecord GetKeyRecord(const string& NetIndicator, date d) const;
+  
+  /// Set the key from a KeyRecord. Throws std::invalid_argument if it
+  /// isn't a valid C52 key.
+  void SetKeyRecord(const KeyRecord& record);
+  
+  /// Load key from a binary key file, taking NetIndicator and d from it
+  /// if present. Returns false if the file doesn't exist and throws
+  /// std::runtime_error if it isn't a key file.
+  bool LoadBinaryKey(const string& fname, string& NetIndicator, date& d);
+  
+  /// Write the current key to a binary key file
+  bool SaveBinaryKey(const string& fname, const string& NetIndicator,
+                     date d) const;
+  
   /// Generaate a random key
   void GenKey(bool CX52=false);
   
+  /// Search up to jobs NumArrays for good drums at once in GenKey. The
+  /// same seed gives the same keys for any number of jobs.
+  void SetSearchJobs(unsigned jobs) {
+    SearchJobs = jobs;
+  }
+  
   //! Generate arrays similar to those in Appendix II of the 1944l
   /// Technical Manual
   void GenNumArrays();
   
+  /// Return the NumArrays GenKey chooses from, group A then group B
+  vector<array<int, NUM_WHEELS> > NumArrays();
+  
   /// Validate that a proposed drum satisfies the sum condition
-  bool ValidateDrum(DrumType drum);
+  bool ValidateDrum(const DrumType& drum) const;
   
   /// Geneate a list of all of the drums that are consistem with NumArray
-  /// and which satisfy the sum dest
+  /// and which satisfy the sum dest. Served from DrumSearchCache after the
+  /// first search for any permutation of NumArray.
   vector<ScoredDrum>
   GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries);
   
+  /// Call visit with the overlaps and score of each good drum for NumArray,
+  /// in search order, without putting them on drums. Returns the number of
+  /// good drums.
+  size_t GoodDrums(const array<int, NUM_WHEELS>& NumArray, int& tries,
+                   const DrumCache::VisitFunction& visit);
+  
+  /// Search for the overlaps of all the good drums for NumArray, in the
+  /// order they are found, without using DrumSearchCache. The search stops
+  /// early, with only the drums found so far, once *cancel is set.
+  DrumCache::Entry SearchDrums(const array<int, NUM_WHEELS>& NumArray,
+                               const std::atomic<bool>* cancel = nullptr);
+  
   //! Reset Letter Counter and Code Wheels.
   //
   void ResetCounter(void);
   
+  //! Advance the code wheels as if letters letters had been ciphered.
+  //
+  //! The wheels 1 to 5 step irregularly, so this still goes letter by
+  //! letter, but only looks up which wheels step in KeyTable.
+  //
+  void FastForward(uint64_t letters);
+  
+  //! Record a checkpoint every interval letters in CipherBuffer and
+  //! CipherStream. 0 turns recording off.
+  //
+  void SetCheckpointInterval(uint64_t interval) {
+    CheckpointInterval = interval;
+  }
+  
+  //! Start the checkpoints of a message at the current wheel positions
+  //! and reset the letter counter.
+  //
+  void StartCheckpoints(void);
+  
+  //! The checkpoints recorded for the current message.
+  //
+  const CheckpointTable& GetCheckpoints(void) const {
+    return Checkpoints;
+  }
+  
+  //! Move the code wheels to letter letterIndex of the message of
+  //! checkpoints, starting from the nearest checkpoint before it, and
+  //! take the print offset from checkpoints. Throws
+  //! std::invalid_argument if checkpoints is empty.
+  //
+  void Seek(uint64_t letterIndex, const CheckpointTable& checkpoints);
+  
   
   //! Set code wheel positions.
   //
   //! Supply at least six indicators. If more than
   //! six are provided, unusable indicators will be discarded.
+  //! The letter counter is reset on success.
   //! Returns true if successful, false if not.
   //
-  bool SetWheels(vector<string> indicator);
+  bool SetWheels(const vector<string>& indicator);
+  
+  
+  //! Set code wheel positions from count indicator names.
+  //
+  //! Same as SetWheels, but neither allocates nor throws, so it suits
+  //! loops which try many indicators.
+  //
+  bool TrySetPositions(const char* const* names, size_t count);
   
   /// Set the print offset
   void SetPrintOffset(int offset) {
     print_offset = offset;
   }
   
-  //! Encipher/Decipher a stream, exit() on EOF.
+  //! Encipher/Decipher a stream. Throws std::runtime_error if the message
+  //! can't be processed, e.g. if its key isn't found.
+  //! With Streaming the output is written as it is produced and the net
+  //! indicator line, which needs the group count, is left out.
   void CipherStream(bool AutoKey,
                     bool AutoMsgIndicator,
                     date d,
                     string& NetIndicator,
                     string KeyDir, bool CipherMode,
-                    istream& InText, ostream& OutText);
-  
-  /// Compare two lugbars for sorting purposes
-  static bool CompareBars(bitset<NUM_WHEELS> a, bitset<NUM_WHEELS> b);
+                    istream& InText, ostream& OutText,
+                    bool Streaming = false);
 };
 
 
@@ -44,47 +44,114 @@ using std::accumulate;
 using std::iota;
 #include "config.h"
 #include "C52.hpp"
+#include "DrumCatalog.h"
+#include "TopReservoir.h"
+#include "FirstSuccess.h"
 
 
-//! Assumes no more than two lugs are active. Sorts based
-//! on the text representation of the lug settings.
-//
-bool C52::CompareBars(bitset <NUM_WHEELS> a, bitset <NUM_WHEELS> b) {
-  unsigned long ai = a.to_ulong();
-  unsigned long bi = b.to_ulong();
-  
-  return (ai < bi);
-}
+namespace {
 
+/// One level of the search in SearchDrums: the number of bars with lugs
+/// on both wheels i1 and i2.
 struct Combo {
   int i1;
   int i2;
-  array<int, NUM_WHEELS> NumArrayIn;
+  array<int, C52::NUM_WHEELS> NumArrayIn;
   int used;
 };
 
-vector<array<int,NUM_WHEELS> > C52::NumArrayA;
-vector<array<int,NUM_WHEELS> > C52::NumArrayB;
+} // namespace
+
+vector<array<int,C52::NUM_WHEELS> > C52::NumArrayA;
+vector<array<int,C52::NUM_WHEELS> > C52::NumArrayB;
+std::once_flag C52::NumArraysFlag;
+DrumCache C52::DrumSearchCache;
+KeyCache<C52::KeyState> C52::KeyListCache;
+std::shared_ptr<const DrumCatalog> C52::Catalog;
+
+/// Validate that a proposed drum satisfies the sum requirement. Only the
+/// cipher bars count; the stepping bars are ignored.
+bool C52::ValidateDrum(const DrumType& drum) const {
+  return Engine::ValidateDrum(drum);
+}
 
-/// Validate that a proposed drum satisfies the sum requirement
-bool C52::ValidateDrum(DrumType drum) {
-  bitset<NUM_LUG_BARS-NUM_WHEELS+2> Sums(0);
-  for (size_t i=0; i< pow(2,NUM_WHEELS); ++i) {
-    bitset<NUM_WHEELS> pins(i);
-    int sum = 0;
-    for (auto itr = drum.begin()+NUM_WHEELS-1; itr < drum.end(); ++itr)
-      sum += ((*itr) & pins).any();
-    Sums[sum] = 1;
+/// Put the stepping lugs on the first bars of drum. Agrees with Dirk's
+/// example.
+void C52::SetSteppingBars(DrumType& drum) {
+  for (int j=0; j<NUM_WHEELS-1; ++j) {
+    for (int i=0; i<NUM_WHEELS; ++i)
+      drum.at(j)[i] = (i<=j);
   }
-  return Sums.all();
 }
 
-/// return a list of all the lugbars that are consistent with the NumArray
-/// and that satisfy the sum test
-vector<ScoredDrum>
-C52::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
-  tries = 0;
-  vector<ScoredDrum> ret;
+/// Put the lugs described by NumArray and overlaps on a drum: the stepping
+/// bars, then the overlapping bars pair by pair, then the single lugs wheel
+/// by wheel.
+C52::ScoredDrum C52::MakeDrum(const array<int, NUM_WHEELS>& NumArray,
+                         const DrumCache::Overlaps& overlaps) {
+  array<int, NUM_WHEELS> num = NumArray;
+  ScoredDrum scored_drum;
+  int j=0;
+  // Determistic stepping lug bars
+  SetSteppingBars(scored_drum.drum);
+  for (j=0; j<NUM_WHEELS-1; ++j) {
+    if (Verbose) {
+      cerr << j << " " << scored_drum.drum.at(j) << endl;
+    }
+  }
+  // put the overlaps on the drum
+  if (Verbose) {
+    cerr << "Overlaps: " << endl;
+  }
+  scored_drum.score = DrumCache::Score(overlaps);
+  for (int i1=0; i1<NUM_WHEELS; ++i1) {
+    for (int i2=i1+1; i2<NUM_WHEELS; ++i2) {
+      int used = overlaps[DrumCache::PairIndex(i1, i2)];
+      for (int i=0; i<used; ++i) {
+        bitset<NUM_WHEELS> lugs(0);
+        lugs[i1]=1;
+        lugs[i2]=1;
+        if (Verbose) {
+          cerr << j << " " << lugs << endl;
+        }
+        scored_drum.drum.at(j++) = lugs;
+        num.at(i1)--;
+        num.at(i2)--;
+      }
+    }
+  }
+  // put the singletons on the drum
+  if (Verbose) {
+    cerr << endl << "Singletons :" << endl;
+  }
+  for (int l=0; l<NUM_WHEELS; ++l) {
+    for (int i=0; i<num.at(l); ++i) {
+      bitset<NUM_WHEELS> lugs(0);
+      lugs[l]=1;
+      if (Verbose) {
+        cerr << j << " " << lugs << endl;
+      }
+      scored_drum.drum.at(j++) = lugs;
+    }
+  }
+  for (int i=0; i<NUM_WHEELS; ++i) {
+    int sum =0;
+    for (int j=NUM_WHEELS-1; j<NUM_LUG_BARS; ++j) {
+      sum += scored_drum.drum.at(j)[i];
+    }
+    if (sum != NumArray[i])
+      throw std::runtime_error("Drum sums don't match NumArray");
+    
+  }
+  return scored_drum;
+}
+
+/// return the overlaps of all the lugbars that are consistent with the
+/// NumArray and that satisfy the sum test
+DrumCache::Entry C52::SearchDrums(const array<int, NUM_WHEELS>& NumArray,
+                                   const std::atomic<bool>* cancel) {
+  DrumCache::Entry ret;
+  ret.tries = 0;
   // Goal is to determine all possible overlaps
   // limits the number of overlaps between any two positions to 4
   const size_t N_CIPHER_LUGS = NUM_LUG_BARS - NUM_WHEELS+1;
@@ -102,8 +169,14 @@ C52::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
       
     }
   }
+  // The keys each pattern of pins can still give, to prune branches that
+  // can't pass the sum test
+  PartialSums<NUM_WHEELS> sums(NumArray, N_CIPHER_LUGS);
+  int pruned = 0;
   int k=0;       //the index in combos
   while (k>=0) {
+    if (cancel && *cancel)
+      break;
     Combo& c = combos.at(k);
     if (Verbose) {
       cerr << "level = " << k << ", i1 = " << c.i1 << ", i2 = " << c.i2;
@@ -120,9 +193,11 @@ C52::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
         break;
       else{
         overlaps += c.used;
+        sums.Add(k, -c.used);
         c.used = 0;
         k--;
         combos.at(k).used++;
+        sums.Add(k, 1);
         overlaps--;
         continue;
       }
@@ -131,88 +206,57 @@ C52::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
       if (overlaps <= c.NumArrayIn[c.i1]
           && overlaps <= c.NumArrayIn[c.i2]
           && overlaps <= 4) {
+        sums.Add(k, overlaps - c.used);
         c.used = overlaps;
         overlaps=0;
       } else {
         // go back up
         overlaps += c.used;
+        sums.Add(k, -c.used);
         c.used = 0;
         k--;
         combos.at(k).used++;
+        sums.Add(k, 1);
         overlaps--;
         continue;
 
       }
     }
+    ret.tries++;
+    bool possible = sums.CanCover(k, overlaps, 4);
+    pruned += !possible;
     if (overlaps == 0) {
-      array<int, NUM_WHEELS> num = NumArray;
-      ScoredDrum scored_drum;
-      int j=0;
-      // Determistic stepping lug bars.  Agrees with Dirk's example.
-      for (j=0; j<NUM_WHEELS-1; ++j) {
-        for (size_t i=0; i<NUM_WHEELS; ++i)
-          scored_drum.drum.at(j)[i] = (i<=j);
-        if (Verbose) {
-          cerr << j << " " << scored_drum.drum.at(j) << endl;
+      if (possible) {
+        DrumCache::Overlaps used;
+        used.fill(0);
+        for (int k1=0; k1<=k; ++k1) {
+          used[DrumCache::PairIndex(combos.at(k1).i1, combos.at(k1).i2)] =
+            combos.at(k1).used;
         }
+        ScoredDrum scored_drum = MakeDrum(NumArray, used);
+        if (ValidateDrum(scored_drum.drum))
+          ret.overlaps.push_back(used);
       }
-      // put the overlaps on the drum
-      if (Verbose) {
-        cerr << "Overlaps: " << endl;
-      }
-      scored_drum.score = 0;
-      for (int k1=0; k1<=k; ++k1) {
-        scored_drum.score += combos.at(k1).used > 0;
-        for (int i=0; i<combos.at(k1).used; ++i) {
-          bitset<NUM_WHEELS> lugs(0);
-          lugs[combos.at(k1).i1]=1;
-          lugs[combos.at(k1).i2]=1;
-          if (Verbose) {
-            cerr << j << " " << lugs << endl;
-          }
-          scored_drum.drum.at(j++) = lugs;
-          num.at(combos.at(k1).i1)--;
-          num.at(combos.at(k1).i2)--;
-        }
-      }
-      // put the singletons on the drum
-      if (Verbose) {
-        cerr << endl << "Singletons :" << endl;
-      }
-      for (int l=0; l<NUM_WHEELS; ++l) {
-        for (int i=0; i<num.at(l); ++i) {
-          bitset<NUM_WHEELS> lugs(0);
-          lugs[l]=1;
-          if (Verbose) {
-            cerr << j << " " << lugs << endl;
-          }
-          scored_drum.drum.at(j++) = lugs;
-        }
-      }
-      tries++;
-      for (int i=0; i<NUM_WHEELS; ++i) {
-        int sum =0;
-        for (int j=NUM_WHEELS-1; j<NUM_LUG_BARS; ++j) {
-          sum += scored_drum.drum.at(j)[i];
-        }
-        if (sum != NumArray[i])
-          throw std::runtime_error("Drum sums don't match NumArray");
-
-      }
-      
-      if (ValidateDrum(scored_drum.drum))
-        ret.push_back(scored_drum);
       // Go back up
       overlaps += c.used;
+      sums.Add(k, -c.used);
       c.used = 0;
       k--;
       if (k<0)
         break;
       combos.at(k).used++;
+      sums.Add(k, 1);
       overlaps--;
       continue;
 
     } // overlaps == 0
+    if (!possible) {
+      // Try the next number of overlaps at this level
+      c.used++;
+      sums.Add(k, 1);
+      overlaps--;
+      continue;
+    }
     // Go down
     k++;
     combos.at(k).used = 0;
@@ -224,10 +268,65 @@ C52::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
     continue;
     
   }
+  if (Verbose) {
+    cerr << "SearchDrums: " << ret.tries << " branches visited, "
+         << pruned << " pruned, " << ret.overlaps.size() << " good drums" << endl;
+  }
   
   return ret;
 }
 
+/// return a list of all the lugbars that are consistent with the NumArray
+/// and that satisfy the sum test
+vector<C52::ScoredDrum>
+C52::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
+  vector<ScoredDrum> ret;
+  GoodDrums(NumArray, tries,
+            [&](const DrumCache::Overlaps& o, int) {
+              ret.push_back(MakeDrum(NumArray, o));
+            });
+  return ret;
+}
+
+/// call visit with the overlaps and score of each good drum for the
+/// NumArray, in search order, without putting them on drums
+size_t C52::GoodDrums(const array<int, NUM_WHEELS>& NumArray, int& tries,
+                       const DrumCache::VisitFunction& visit) {
+  return Engine::GoodDrums(DrumSearchCache, NumArray, tries,
+                           [this](const DrumCache::NumArrayType& sorted) {
+                             return SearchDrums(sorted);
+                           }, visit);
+}
+
+/// Map the drum catalog in file fname for use by GenKey
+void C52::LoadDrumCatalog(const string& fname) {
+  Catalog = std::make_shared<const DrumCatalog>(fname);
+}
+
+/// Pick a drum for NumArray from the catalog, if it's there
+int C52::CatalogDrum(const array<int, NUM_WHEELS>& NumArray) {
+  array<int, NUM_WHEELS> perm;
+  DrumCache::NumArrayType sorted;
+  DrumCache::SortWheels(NumArray, perm, sorted);
+  const DrumCatalog::Entry* entry = Catalog->Find(sorted);
+  if (!entry)
+    return -1;
+  if (entry->candidates == 0)
+    return 0;
+  ui_dist dist_drum(0, static_cast<int>(entry->candidates-1));
+  DrumCatalog::Bars bars = Catalog->Drum(*entry, dist_drum(gen));
+  SetSteppingBars(Drum);
+  // Bit c of a catalog bar is wheel perm[c] of NumArray
+  for (int b=0; b<DrumCatalog::CIPHER_BARS; ++b) {
+    bitset<NUM_WHEELS> lugs(0);
+    for (int c=0; c<NUM_WHEELS; ++c) {
+      lugs[perm[c]] = (bars[b] >> c) & 1;
+    }
+    Drum.at(NUM_WHEELS-1+b) = lugs;
+  }
+  return 1;
+}
+
 /// Generate a key using the method descibed in the Appendices of the
 /// 1944 Technical Manual
 void C52::GenKey(bool CX52) {
@@ -244,26 +343,21 @@ void C52::GenKey(bool CX52) {
    in which from 40 to 60 per cent of the pins are in the errectie positon
    is assured by this method.
 */
-  if (NumArrayA.size()==0) {
-    GenNumArrays();
-  }
-  array<size_t, 12> wheel_idx;
+  std::call_once(NumArraysFlag, &C52::GenNumArrays, this);
+  array<size_t, 12> all_idx;
   if (CX52) {
     for (int i=0; i<NUM_WHEELS; ++i)
-      wheel_idx.at(i) = 11;  // the whell with 47 positions
+      all_idx.at(i) = 11;  // the whell with 47 positions
   } else {
     /* Unlike the M209 we have to select the wheels for a C52 from
      a list of 12 possibilities.
      */
-    iota(wheel_idx.begin(), wheel_idx.end(), 0);
-    shuffle(wheel_idx.begin(), wheel_idx.end(), gen);
+    iota(all_idx.begin(), all_idx.end(), 0);
+    shuffle(all_idx.begin(), all_idx.end(), gen);
   }
   for (int i=0; i<NUM_WHEELS; ++i){
-    Wheels.at(i).Clear();
-    for (auto a : wheel_labels.at(wheel_idx.at(i))) {
-      Wheels.at(i).AddPosition(a);
-    }
-    Wheels.at(i).SetReadOffset(offsets.at(wheel_idx.at(i)));
+    wheel_idx.at(i) = all_idx.at(i);
+    Wheels.at(i).SetType(wheel_types().at(wheel_idx.at(i)));
     Wheels.at(i).Randomize();
   }
   /*
@@ -276,41 +370,92 @@ void C52::GenKey(bool CX52) {
    not succeed each other in a key list.
    */
   
-  // Find a NumArray that has at least one good drum
-  vector<ScoredDrum> good_drums;
+  // Find a NumArray that has at least one good drum. Only the best
+  // candidates are kept: every drum with the best score or, if fewer than
+  // NUM_CANDIDATES have it, the NUM_CANDIDATES best drums.
+  TopReservoir<DrumCache::Overlaps> candidates(NUM_CANDIDATES);
+  array<int, NUM_WHEELS> NumArray;
   int tries;
-  do {
+  int from_catalog = -1;
+  auto DrawNumArray = [this](ChaChaRandom& g) {
     bernoulli_distribution dist_A(.9);
-    bool A = dist_A(gen);
+    bool A = dist_A(g);
     vector<array<int, NUM_WHEELS> >& NumArrays = A ? NumArrayA : NumArrayB;
     ui_dist dist(0, static_cast<int>(NumArrays.size()-1));
-    array<int, NUM_WHEELS> NumArray = NumArrays[dist(gen)];
-    shuffle(NumArray.begin(), NumArray.end(), gen);
-    good_drums = GoodDrums(NumArray, tries);
-  } while (good_drums.size() == 0);
-  
-  // Sort the good drums and randomly pick one from the best candidates.
-  sort(good_drums.begin(), good_drums.end());
-  int best_score = good_drums.back().score;
-  int num_best_score=0;
-  for (auto itr = good_drums.begin(); itr<good_drums.end(); ++itr){
-    num_best_score += ((*itr).score == best_score);
+    array<int, NUM_WHEELS> NumArray = NumArrays[dist(g)];
+    shuffle(NumArray.begin(), NumArray.end(), g);
+    return NumArray;
+  };
+  // NumArray n is drawn from stream n of a seed taken once from gen, so
+  // that the NumArrays and the use of gen after them don't depend on how
+  // many are searched at once.
+  uint64_t draw_seed = gen();
+  draw_seed = draw_seed << 32 | gen();
+  uint64_t draw_stream = 0;
+  std::function<array<int, NUM_WHEELS>()> DrawNext = [&]() {
+    ChaChaRandom g(draw_seed, draw_stream++);
+    return DrawNumArray(g);
+  };
+  if (SearchJobs > 1 && !Catalog) {
+    // Search SearchJobs NumArrays at a time, keeping the first in the
+    // order drawn that has a good drum, as the loop below does. Which
+    // NumArrays are searched but not kept depends on the timing of the
+    // threads, but they don't use gen.
+    vector<DrumCache::Overlaps> found;
+    FirstSuccess<array<int, NUM_WHEELS>, vector<DrumCache::Overlaps> >(
+      SearchJobs, DrawNext,
+      [this](const array<int, NUM_WHEELS>& num,
+             vector<DrumCache::Overlaps>& overlaps,
+             const std::atomic<bool>& cancel) {
+        int tries;
+        overlaps = DrumSearchCache.Lookup(num, tries,
+                     [this, &cancel](const DrumCache::NumArrayType& sorted) {
+                       return SearchDrums(sorted, &cancel);
+                     }, &cancel);
+        return !overlaps.empty();
+      }, NumArray, found);
+    for (auto& o : found) {
+      candidates.Offer(DrumCache::Score(o), o, gen);
+    }
+  } else {
+    do {
+      candidates.clear();
+      NumArray = DrawNext();
+      if (Catalog) {
+        from_catalog = CatalogDrum(NumArray);
+        if (from_catalog == 1)
+          break;
+        if (from_catalog == 0)
+          continue;
+      }
+      GoodDrums(NumArray, tries,
+                [&](const DrumCache::Overlaps& o, int score) {
+                  candidates.Offer(score, o, gen);
+                });
+    } while (candidates.empty());
   }
-  int num_candidates = std::min(static_cast<int>(good_drums.size()),
-                                std::max(25,num_best_score));
   
-  // Randomly select from the list of candidates
-  // The good ones are at the end
-  ui_dist dist_drum(0,num_candidates-1);
-  Drum = (*(good_drums.rbegin()+dist_drum(gen))).drum;
+  if (from_catalog != 1) {
+    // Randomly select from the candidates
+    Drum = MakeDrum(NumArray, candidates.Pick(gen)).drum;
+  }
   
   // Sort the bars to make it easier for the operator to set them
   // in a real machine
-  sort(Drum.begin()+NUM_WHEELS-1, Drum.end(), CompareBars);
+  sort(Drum.begin()+NUM_WHEELS-1, Drum.end(), Engine::CompareBarBits);
+  BuildKeyTable();
   
 
 }
 
+/// Return the NumArrays GenKey chooses from
+vector<array<int, C52::NUM_WHEELS> > C52::NumArrays() {
+  std::call_once(NumArraysFlag, &C52::GenNumArrays, this);
+  vector<array<int, NUM_WHEELS> > ret = NumArrayA;
+  ret.insert(ret.end(), NumArrayB.begin(), NumArrayB.end());
+  return ret;
+}
+
 /// Generate the Number Lists in Appendix II of the 1944 Technical Manual
 void C52::GenNumArrays() {
   
@@ -41,6 +41,7 @@ public:
   //
   //! Randomize such that 40%-60% are active and no
   //! more than three consecutive pins have the same setting.
+  //! Every such setting is equally likely.
   //
   void Randomize(void);
 
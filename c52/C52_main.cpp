@@ -45,6 +45,7 @@ using std::exception;
 #define SOURCE
 #include "config.h"
 #include "C52.hpp"
+#include "Batch.h"
 
 //! If true, enable verbose debugging messages to stderr.
 //
@@ -81,7 +82,7 @@ int main(int argc, char **argv)
   string  FileOut;
   bool    AutoKey = false;
   bool    AutoMsgIndicator = false;
-  vector<string>  indicator(NUM_WHEELS,"A");
+  vector<string>  indicator(C52::NUM_WHEELS,"A");
   char    print_offset;
   date   d;
   string KeyFileName;
@@ -91,6 +92,17 @@ int main(int argc, char **argv)
   string    NetIndicator;
   bool CX52 = false;
   size_t      SkipChars = 0;
+  uint64_t    SeekLetter = 0;
+  string      CheckpointFile;
+  uint64_t    CheckpointInterval = 1000;
+  C52::CheckpointTable  Checkpoints;
+  uint64_t    Seed = 0;
+  string    DrumCatalogFile;
+  bool      Streaming = false;
+  string    BinaryKeyFile;
+  bool      Batch = false;
+  unsigned  Jobs = 1;
+  bool      Failed = false;
   
   // Parse command-line arguments
   options_description desc("C52 options description");
@@ -112,14 +124,24 @@ int main(int argc, char **argv)
   (",n", value<string>(&NetIndicator), "Specify a net indicator for use in -a or -p modes.\nMust be a single word consisting of only letters and/or numbers.")
   (",p", "print key settings to FileOUt or cout")
   (",e", "export key settings in Dirk Rijmenantsto format to FileOut or cout")
+  ("binaryKey", value<string>(&BinaryKeyFile), "Write the key setting to the specified file in the\nbinary format read by -k and -t for .c52bin files.")
   (",s", value<size_t>(&SkipChars),"Skip number of leading characters specified in following argument.")
+  ("seek", value<uint64_t>(&SeekLetter), "The input starts at the letter of the message with\nthe following index, counting from 0. Requires -i\nor --checkpoints when deciphering.")
+  ("checkpoints", value<string>(&CheckpointFile), "With -c write the wheel positions every\n--checkpointInterval letters to the specified file.\nWith -d start from the positions in the file instead\nof -i, at the nearest one before --seek.")
+  ("checkpointInterval", value<uint64_t>(&CheckpointInterval), "Letters between checkpoints written with -c.\nDefault is 1000.")
   (",t", value<string>(&KeyDir), "Specify directory containing key files for -a mode.\nDefault is current directory.")
+  ("seed", value<uint64_t>(&Seed), "Seed the random number generator so that\ngenerated keys and indicators can be reproduced.")
+  ("drumCatalog", value<string>(&DrumCatalogFile), "Pick generated drums from a catalog written by\nhagelin-drumcatalog instead of searching.")
+  ("batch", bool_switch(&Batch), "Process a series of messages separated by lines\nholding only " BATCH_SEPARATOR ". The outputs are separated\nthe same way, and a message that fails is reported\nwithout stopping the others.")
+  (",j", value<unsigned>(&Jobs), "Number of messages to process in parallel\nin --batch mode, or of drum searches to run\nat once with -g.")
+  ("stream", bool_switch(&Streaming), "Write the output as the input is read, in constant\nmemory. The net indicator line is left out.")
   (",q", bool_switch(&Quiet), "Suppress informational messages.")
   (",v", bool_switch(&Verbose), "Print verbose debug messages to stderr.");
   
   variables_map vm;
   store(parse_command_line(argc, argv, desc), vm);
   notify(vm);
+  c52.SetContext(Context());
   
   if (vm.count("help")) {
     PrintVersion(cerr);
@@ -143,8 +165,23 @@ int main(int argc, char **argv)
     CipherMode = false;
     DoCipher = true;
   }
+  bool ReadCheckpoints = DoCipher && !CipherMode && vm.count("checkpoints");
+  
+  if (vm.count("seed")) {
+    gen.seed(Seed);
+  }
+  
+  if (vm.count("drumCatalog")) {
+    try {
+      C52::LoadDrumCatalog(DrumCatalogFile);
+    } catch (std::runtime_error& e) {
+      cerr << "ERROR: " << e.what() << endl;
+      exit(1);
+    }
+  }
   
   if (vm.count("-g")) {
+    c52.SetSearchJobs(Jobs);
     c52.GenKey(CX52);
   }
   
@@ -155,6 +192,13 @@ int main(int argc, char **argv)
       cerr << desc << endl;
       exit(1);
     }
+    // Checked here rather than when each message loads its key, so that a
+    // batch doesn't start only to have every message fail.
+    if (getenv("C52_KEYLIST_DIR") == nullptr) {
+      cerr << "ERROR: Environmental variable C52_KEYLIST_DIR must be defined to";
+      cerr << " use the -A mode." << endl;
+      exit(1);
+    }
     if ((vm.count("-c") || vm.count("-p")) && NetIndicator.size()==0) {
       NetIndicator = "C52NET";
     }
@@ -165,27 +209,68 @@ int main(int argc, char **argv)
       exit(1);
     }
   } else {
-    if (DoCipher && (vm.count("-k")==0 || vm.count("-i")==0)) {
+    if (DoCipher && (vm.count("-k")==0
+                     || (vm.count("-i")==0 && !ReadCheckpoints))) {
       cerr << "ERROR: Both -k and -i must be specified in manual mode" << endl;
       cerr << desc << endl;
       exit(1);
     }
   }
-  if (DoCipher && ((vm.count("-i")+AutoMsgIndicator) !=1 )){
-    cerr << "ERROR: Either -i or autoMsg must be specified but not both" << endl;
+  if (vm.count("checkpoints")) {
+    if (!DoCipher || Batch) {
+      cerr << "ERROR: --checkpoints requires a single message to encipher or decipher" << endl;
+      cerr << desc << endl;
+      exit(1);
+    }
+    if (CipherMode && vm.count("seek")) {
+      cerr << "ERROR: --seek cannot be used when writing checkpoints" << endl;
+      cerr << desc << endl;
+      exit(1);
+    }
+    if (ReadCheckpoints && AutoMsgIndicator) {
+      cerr << "ERROR: --checkpoints cannot be used with -a for deciphering" << endl;
+      cerr << desc << endl;
+      exit(1);
+    }
+  }
+  if (CheckpointInterval == 0) {
+    cerr << "ERROR: --checkpointInterval must be positive" << endl;
+    cerr << desc << endl;
+    exit(1);
+  }
+  if (vm.count("seek") && AutoMsgIndicator) {
+    cerr << "ERROR: --seek can only be used with -i or --checkpoints" << endl;
+    cerr << desc << endl;
+    exit(1);
+  }
+  if (ReadCheckpoints) {
+    ifstream fcheckpoints(CheckpointFile);
+    if (!fcheckpoints) {
+      cerr << "ERROR: Unable to open checkpoint file " << CheckpointFile << endl;
+      exit(1);
+    }
+    try {
+      Checkpoints.Read(fcheckpoints);
+    } catch (std::runtime_error& e) {
+      cerr << "ERROR: " << CheckpointFile << ": " << e.what() << endl;
+      exit(1);
+    }
+  }
+  if (DoCipher && ((vm.count("-i")+AutoMsgIndicator+ReadCheckpoints) !=1 )){
+    cerr << "ERROR: One of -i, autoMsg or --checkpoints must be specified" << endl;
     cerr << desc << endl;
     exit(1);
   }
   if (vm.count("-i")) {
-    if (indicator.size() != NUM_WHEELS) {
+    if (indicator.size() != C52::NUM_WHEELS) {
       cerr << "ERROR: -i requires "
-      << dec << NUM_WHEELS
+      << dec << C52::NUM_WHEELS
       << " arguments."
       << endl;
       cerr << desc << endl;
       exit(1);
     }
-    for (i=0; i<NUM_WHEELS; i++) {
+    for (i=0; i<C52::NUM_WHEELS; i++) {
       
       if (indicator[i].size() != 1 || !isalpha(indicator[i][0])) {
         cerr << "ERROR: -i requires single-letter alphabetic arguments"
@@ -249,42 +334,106 @@ int main(int argc, char **argv)
       c52.ExportKey(NetIndicator, d, out);
   }
   
-  if (DoCipher) {
-    if (!AutoMsgIndicator) {
-      c52.SetPrintOffset(print_offset-'A');
-      if (!c52.SetWheels(indicator)) {
-        cerr << "ERROR: Invalid wheel position(s) specified"
-        << endl;
+  if (vm.count("binaryKey")) {
+    if (AutoKey && !(vm.count("-p") || vm.count("-e"))) {
+      if (!c52.LoadKey(d, NetIndicator)) {
+        cerr << "ERROR: Unable to load key from data base" << endl;
         exit(1);
       }
     }
-    
+    if (!c52.SaveBinaryKey(BinaryKeyFile, NetIndicator, d)) {
+      cerr << "ERROR: Unable to write binary key file " << BinaryKeyFile << endl;
+      exit(1);
+    }
+  }
+  
+  if (DoCipher) {
     if (!Quiet) {
       cerr << "Reading from text..." << endl;
     }
     
-    if (SkipChars > 0) {
-      if (!Quiet) {
-        cerr << "(Skipping first " << SkipChars << " characters)" << endl;
+    // Encipher or decipher message n. Each message of a batch starts from
+    // the indicators given on the command line and, if a seed is given,
+    // from its own stream of the seed, so that its output doesn't depend
+    // on the number of jobs.
+    auto CipherMessage = [&](C52& machine, size_t n, istream& is,
+                             ostream& os) {
+      const Context& context = machine.GetContext();
+      if (Batch && vm.count("seed")) {
+        gen.seed(Seed, n);
+      }
+      date MsgDate = d;
+      string MsgNetIndicator = NetIndicator;
+      if (ReadCheckpoints) {
+        machine.Seek(SeekLetter, Checkpoints);
+      } else if (!AutoMsgIndicator) {
+        machine.SetPrintOffset(print_offset-'A');
+        if (!machine.SetWheels(indicator)) {
+          throw std::runtime_error("Invalid wheel position(s) specified");
+        }
+        machine.FastForward(SeekLetter);
       }
-      char c;
-      for (int n = 0; n< SkipChars; ) {
-        if (!in.good()) {
-          break;
+      
+      if (SkipChars > 0) {
+        if (!context.Quiet) {
+          *context.Log << "(Skipping first " << SkipChars << " characters)"
+                       << endl;
         }
-        c = in.get();
-        if (!isspace(c)) {
-          ++n;
+        char c;
+        for (int n = 0; n< SkipChars; ) {
+          if (!is.good()) {
+            break;
+          }
+          c = is.get();
+          if (!isspace(c)) {
+            ++n;
+          }
+        }
+      }
+      
+      machine.CipherStream(AutoKey,
+                        AutoMsgIndicator,
+                        MsgDate,
+                        MsgNetIndicator,
+                        KeyDir, CipherMode, is, os, Streaming);
+    };
+    
+    if (Batch) {
+      // Messages are separated by BATCH_SEPARATOR lines, and so are their
+      // outputs. A message that fails leaves its output empty.
+      size_t count = 0;
+      size_t failed = CipherBatch<C52>(c52, Jobs, in, out, CipherMessage,
+                                       count);
+      if (!Quiet) {
+        cerr << count << " messages, " << failed << " failed" << endl;
+      }
+      Failed = failed > 0;
+    } else {
+      if (vm.count("checkpoints") && CipherMode) {
+        c52.SetCheckpointInterval(CheckpointInterval);
+      }
+      try {
+        CipherMessage(c52, 1, in, out);
+      } catch (std::runtime_error& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        exit(1);
+      }
+      if (vm.count("checkpoints") && CipherMode) {
+        ofstream checkpoints(CheckpointFile);
+        c52.GetCheckpoints().Write(checkpoints);
+        if (!checkpoints) {
+          cerr << "ERROR: Unable to write checkpoint file " << CheckpointFile
+               << endl;
+          exit(1);
         }
       }
     }
-   
-    c52.CipherStream(AutoKey,
-                      AutoMsgIndicator,
-                      d,
-                      NetIndicator,
-                      KeyDir, CipherMode, in, out);
   }
   
-  return 0;
+  if (Verbose) {
+    cerr << "Key cache: " << C52::KeyListCache.hits() << " hits, "
+         << C52::KeyListCache.misses() << " misses" << endl;
+  }
+  
+  return Failed ? 1 : 0;
 }
@@ -0,0 +1,181 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file Batch.h
+ * \brief Definition of the CipherBatch function template.
+ * \package hagelin
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <cstddef>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <iostream>
+using std::istream;
+using std::ostream;
+using std::endl;
+#include <sstream>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "LetterReader.h"
+#include "Context.h"
+
+
+/*!
+ * \brief Encipher or decipher the messages of a batch on Jobs threads.
+ *
+ * The messages are read from in, separated by BATCH_SEPARATOR lines, and
+ * each is passed to cipher with its number, counting from 1, and a copy
+ * of machine owned by the thread. Threads take the next message not yet
+ * started, so a long message doesn't hold up the others.
+ *
+ * The messages are read on the calling thread as the threads need them.
+ * At most twice Jobs messages are held at once, read but not yet written,
+ * so a batch of any length is processed in bounded memory.
+ *
+ * The outputs are written to out in the order of the messages, each
+ * followed by a BATCH_SEPARATOR line, as soon as they and the messages
+ * before them are done. What a message logs is collected and written to
+ * the log of machine along with its output. A message for which cipher
+ * throws is reported there with its number and its output is left empty.
+ *
+ * Returns the number of messages that failed and sets count to the number
+ * of messages.
+ */
+template<class Machine>
+size_t CipherBatch(const Machine& machine, unsigned Jobs, istream& in,
+                   ostream& out,
+                   const std::function<void(Machine&, size_t, istream&,
+                                            ostream&)>& cipher,
+                   size_t& count) {
+  struct Slot {
+    string  message;
+    bool    done = false;
+    string  output;
+    string  log;
+    string  error;
+  };
+  // Messages read but not yet written, the first being message first + 1.
+  // Adding and removing slots at the ends leaves the others in place.
+  std::deque<Slot> slots;
+  size_t first = 0;
+  size_t next = 0;           // first message not yet started
+  bool end_of_input = false;
+  std::mutex mutex;
+  std::condition_variable message_ready;
+  std::condition_variable result_done;
+  
+  auto Worker = [&]() {
+    Machine m(machine);
+    Context context = machine.GetContext();
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      message_ready.wait(lock, [&]() {
+        return next < first + slots.size() || end_of_input;
+      });
+      if (next == first + slots.size()) {
+        break;
+      }
+      size_t i = next++;
+      Slot& slot = slots[i - first];
+      std::istringstream is(std::move(slot.message));
+      lock.unlock();
+      
+      std::ostringstream os, log;
+      context.Log = &log;
+      m.SetContext(context);
+      string error;
+      try {
+        cipher(m, i + 1, is, os);
+      } catch (std::exception& e) {
+        error = e.what();
+      }
+      
+      lock.lock();
+      slot.output = os.str();
+      slot.log = log.str();
+      slot.error = error;
+      slot.done = true;
+      result_done.notify_all();
+    }
+  };
+  
+  vector<std::thread> workers;
+  for (unsigned j = 0; j < std::max(Jobs, 1u); ++j) {
+    workers.push_back(std::thread(Worker));
+  }
+  
+  const size_t limit = 2 * std::max(Jobs, 1u);
+  ostream& log = *machine.GetContext().Log;
+  size_t failed = 0;
+  string message;
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!end_of_input && slots.size() < limit) {
+      lock.unlock();
+      bool read = ReadMessage(in, message);
+      lock.lock();
+      if (read) {
+        slots.emplace_back();
+        std::swap(slots.back().message, message);
+      } else {
+        end_of_input = true;
+      }
+      message_ready.notify_all();
+      continue;
+    }
+    if (slots.empty()) {
+      break;
+    }
+    result_done.wait(lock, [&]() { return slots.front().done; });
+    Slot result = std::move(slots.front());
+    slots.pop_front();
+    ++first;
+    lock.unlock();
+    
+    log << result.log;
+    if (result.error.empty()) {
+      out << result.output;
+    } else {
+      log << "ERROR: message " << first << ": " << result.error << endl;
+      ++failed;
+    }
+    out << BATCH_SEPARATOR << endl;
+  }
+  
+  for (auto& w : workers) {
+    w.join();
+  }
+  count = first;
+  return failed;
+}
+
+#endif // _BATCH_H_
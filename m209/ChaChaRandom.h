@@ -0,0 +1,170 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file ChaChaRandom.h
+ * \brief Definition of the ChaChaRandom class.
+ * \package hagelin
+ */
+
+#ifndef _CHACHARANDOM_H_
+#define _CHACHARANDOM_H_
+
+#include <cstdint>
+#include <array>
+#include <random>
+
+
+/*!
+ * \brief Random bit generator based on the ChaCha20 stream cipher.
+ *
+ * Satisfies the UniformRandomBitGenerator requirements, so it can be
+ * used with the standard distributions and std::shuffle.
+ *
+ * By default the 256 bit key is read once from std::random_device, after
+ * which numbers are produced without any system calls. seed() replaces
+ * the key with a 64 bit value so that a run can be repeated exactly.
+ * The standard distributions are implementation defined, so repeated
+ * runs only match when built with the same standard library.
+ */
+class ChaChaRandom {
+
+public:
+
+    typedef uint32_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffff; }
+
+    //! Construct a generator keyed from std::random_device.
+    //
+    ChaChaRandom() {
+      std::random_device rd;
+      for (size_t i=0; i<Key.size(); i++) {
+        Key[i] = rd();
+      }
+      Stream = 0;
+      Restart();
+    }
+
+    //! Construct a generator with a reproducible seed.
+    //
+    explicit ChaChaRandom(uint64_t s, uint64_t stream = 0) {
+      seed(s, stream);
+    }
+
+    //! Reseed with a reproducible seed.
+
+    //! Generators with the same seed and different streams produce
+    //! independent sequences.
+    //
+    void seed(uint64_t s, uint64_t stream = 0) {
+      Key.fill(0);
+      Key[0] = uint32_t(s);
+      Key[1] = uint32_t(s >> 32);
+      Stream = stream;
+      Restart();
+    }
+
+    //! Return the next 32 random bits.
+    //
+    result_type operator()() {
+      if (Index == Block.size()) {
+        Refill();
+      }
+      return Block[Index++];
+    }
+
+private:
+
+    //! Cipher key.
+    //
+    std::array<uint32_t, 8>   Key;
+
+    //! Stream number, used as the ChaCha nonce.
+    //
+    uint64_t                  Stream;
+
+    //! Number of the next block to be generated.
+    //
+    uint64_t                  Counter;
+
+    //! Current block of output.
+    //
+    std::array<uint32_t, 16>  Block;
+
+    //! Index of the next unused word of Block.
+    //
+    size_t                    Index;
+
+
+    //! Start again from the first block.
+    //
+    void Restart() {
+      Counter = 0;
+      Index = Block.size();
+    }
+
+    static uint32_t Rotl(uint32_t x, int n) {
+      return (x << n) | (x >> (32 - n));
+    }
+
+    static void QuarterRound(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d) {
+      a += b; d ^= a; d = Rotl(d, 16);
+      c += d; b ^= c; b = Rotl(b, 12);
+      a += b; d ^= a; d = Rotl(d, 8);
+      c += d; b ^= c; b = Rotl(b, 7);
+    }
+
+    //! Generate the next block with the ChaCha20 block function.
+    //
+    void Refill() {
+      std::array<uint32_t, 16> in;
+      in[0] = 0x61707865;       // "expand 32-byte k"
+      in[1] = 0x3320646e;
+      in[2] = 0x79622d32;
+      in[3] = 0x6b206574;
+      for (size_t i=0; i<Key.size(); i++) {
+        in[4+i] = Key[i];
+      }
+      in[12] = uint32_t(Counter);
+      in[13] = uint32_t(Counter >> 32);
+      in[14] = uint32_t(Stream);
+      in[15] = uint32_t(Stream >> 32);
+
+      Block = in;
+      for (int i=0; i<10; i++) {
+        QuarterRound(Block[0], Block[4], Block[8], Block[12]);
+        QuarterRound(Block[1], Block[5], Block[9], Block[13]);
+        QuarterRound(Block[2], Block[6], Block[10], Block[14]);
+        QuarterRound(Block[3], Block[7], Block[11], Block[15]);
+        QuarterRound(Block[0], Block[5], Block[10], Block[15]);
+        QuarterRound(Block[1], Block[6], Block[11], Block[12]);
+        QuarterRound(Block[2], Block[7], Block[8], Block[13]);
+        QuarterRound(Block[3], Block[4], Block[9], Block[14]);
+      }
+      for (size_t i=0; i<Block.size(); i++) {
+        Block[i] += in[i];
+      }
+      ++Counter;
+      Index = 0;
+    }
+};
+
+#endif // _CHACHARANDOM_H_
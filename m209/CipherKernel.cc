@@ -0,0 +1,163 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file CipherKernel.cc
+ * \brief Implementation of CipherKernel class member functions.
+ * \package hagelin
+ */
+
+#include <stdexcept>
+
+#include "CipherKernel.h"
+
+// The vector kernels need the GCC/Clang target attribute and CPU
+// feature builtins. Other compilers get the scalar kernel only.
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define HAGELIN_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// With 0 <= in - 'A' <= 25 and 0 <= key <= 52 the sum is at most 77,
+// so two conditional subtractions of 26 reduce it to 0..25.
+
+static void ApplyScalar(const char* in, const unsigned char* key,
+                        size_t length, char* out) {
+  for (size_t n=0; n<length; n++) {
+    int cnum = in[n] - 'A' + key[n];
+    if (cnum >= 26) {
+      cnum -= 26;
+    }
+    if (cnum >= 26) {
+      cnum -= 26;
+    }
+    out[n] = 'Z' - cnum;
+  }
+}
+
+
+#ifdef HAGELIN_X86_KERNELS
+
+// min(x, x - 26) on unsigned bytes subtracts 26 when x >= 26, and
+// otherwise keeps x because x - 26 wraps around to a large value.
+
+static void ApplySSE2(const char* in, const unsigned char* key,
+                      size_t length, char* out) {
+  const __m128i  a = _mm_set1_epi8('A');
+  const __m128i  z = _mm_set1_epi8('Z');
+  const __m128i  m = _mm_set1_epi8(26);
+  size_t         n = 0;
+
+  for ( ; n+16 <= length; n += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+n));
+    __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key+n));
+    x = _mm_add_epi8(_mm_sub_epi8(x, a), k);
+    x = _mm_min_epu8(x, _mm_sub_epi8(x, m));
+    x = _mm_min_epu8(x, _mm_sub_epi8(x, m));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out+n), _mm_sub_epi8(z, x));
+  }
+  ApplyScalar(in+n, key+n, length-n, out+n);
+}
+
+
+__attribute__((target("avx2")))
+static void ApplyAVX2(const char* in, const unsigned char* key,
+                      size_t length, char* out) {
+  const __m256i  a = _mm256_set1_epi8('A');
+  const __m256i  z = _mm256_set1_epi8('Z');
+  const __m256i  m = _mm256_set1_epi8(26);
+  size_t         n = 0;
+
+  for ( ; n+32 <= length; n += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in+n));
+    __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key+n));
+    x = _mm256_add_epi8(_mm256_sub_epi8(x, a), k);
+    x = _mm256_min_epu8(x, _mm256_sub_epi8(x, m));
+    x = _mm256_min_epu8(x, _mm256_sub_epi8(x, m));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out+n), _mm256_sub_epi8(z, x));
+  }
+  ApplySSE2(in+n, key+n, length-n, out+n);
+}
+
+#endif // HAGELIN_X86_KERNELS
+
+
+bool CipherKernel::Supported(Isa isa) {
+  switch (isa) {
+    case SCALAR:
+      return true;
+#ifdef HAGELIN_X86_KERNELS
+    case SSE2:
+      return true;
+    case AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+
+CipherKernel::Isa CipherKernel::Best(void) {
+  static const Isa best = Supported(AVX2) ? AVX2 :
+                          Supported(SSE2) ? SSE2 : SCALAR;
+  return best;
+}
+
+
+const char* CipherKernel::Name(Isa isa) {
+  switch (isa) {
+    case SCALAR:
+      return "scalar";
+    case SSE2:
+      return "SSE2";
+    case AVX2:
+      return "AVX2";
+    default:
+      return "unknown";
+  }
+}
+
+
+void CipherKernel::Apply(const char* in, const unsigned char* key,
+                         size_t length, char* out) {
+  Apply(Best(), in, key, length, out);
+}
+
+
+void CipherKernel::Apply(Isa isa, const char* in, const unsigned char* key,
+                         size_t length, char* out) {
+  if (!Supported(isa)) {
+    throw std::invalid_argument("CipherKernel::Apply(): instruction set not supported");
+  }
+  switch (isa) {
+#ifdef HAGELIN_X86_KERNELS
+    case AVX2:
+      ApplyAVX2(in, key, length, out);
+      break;
+    case SSE2:
+      ApplySSE2(in, key, length, out);
+      break;
+#endif
+    default:
+      ApplyScalar(in, key, length, out);
+      break;
+  }
+}
@@ -0,0 +1,89 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file CipherKernel.h
+ * \brief Definition of the CipherKernel class.
+ * \package hagelin
+ */
+
+#ifndef _CIPHERKERNEL_H_
+#define _CIPHERKERNEL_H_
+
+#include <cstddef>
+using std::size_t;
+
+
+/*!
+ * \brief Applies a precomputed keystream to a buffer of letters.
+ *
+ * Both the M209 and the C52 print from the reciprocal alphabet, so once
+ * the key value for each letter is known the transform
+ * out = 'Z' - mod(in - 'A' + key, 26) is independent from letter to
+ * letter. The machines supply additive keys: the C52 key is already
+ * additive and the M209 passes 52 - key.
+ *
+ * Vector implementations are selected at run time from the features
+ * of the CPU.
+ */
+class CipherKernel {
+
+public:
+
+    //! Instruction set used by an implementation of the transform.
+    //
+    enum Isa {
+      SCALAR,           //!< Portable C++.
+      SSE2,             //!< 16 letters per instruction.
+      AVX2              //!< 32 letters per instruction.
+    };
+
+    //! Largest key value accepted by Apply().
+    //
+    static const int MAX_KEY = 52;
+
+    //! Return true if isa can be used on this CPU.
+    //
+    static bool Supported(Isa isa);
+
+    //! Return the fastest instruction set supported by this CPU.
+    //
+    static Isa Best(void);
+
+    //! Return the name of an instruction set.
+    //
+    static const char* Name(Isa isa);
+
+    //! Encipher/decipher length letters using the fastest implementation.
+
+    //! in must hold upper case letters and 0 <= key[n] <= MAX_KEY.
+    //! in and out may be the same buffer.
+    //
+    static void Apply(const char* in, const unsigned char* key,
+                      size_t length, char* out);
+
+    //! Encipher/decipher length letters using the given instruction set.
+
+    //! Throws std::invalid_argument if isa is not supported by this CPU.
+    //
+    static void Apply(Isa isa, const char* in, const unsigned char* key,
+                      size_t length, char* out);
+};
+
+#endif // _CIPHERKERNEL_H_
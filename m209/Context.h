@@ -0,0 +1,55 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file Context.h
+ * \brief Definition of the Context struct.
+ * \package hagelin
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <iostream>
+
+extern bool Verbose;
+extern bool Quiet;
+
+
+/*!
+ * \brief How a machine reports what it is doing.
+ *
+ * Each M209 or C52 reports on loading keys and on enciphering and
+ * deciphering messages according to its own Context, so that machines on
+ * different threads can log to different streams. A default Context
+ * follows the global Verbose and Quiet flags as they are when it is made
+ * and logs to std::cerr.
+ *
+ * Random numbers come from the thread's own generator gen (see config.h),
+ * which isn't part of the Context.
+ */
+struct Context {
+
+    bool          Verbose = ::Verbose;  //!< print debug messages
+    bool          Quiet = ::Quiet;      //!< suppress informational messages
+    std::ostream* Log = &std::cerr;     //!< where messages go
+};
+
+#endif // _CONTEXT_H_
@@ -0,0 +1,186 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCache.cc
+ * \brief Implementation of DrumCache class member functions.
+ * \package hagelin
+ */
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+#include <algorithm>
+using std::sort;
+using std::stable_sort;
+#include <stdexcept>
+
+#include "DrumCache.h"
+
+//! First line of a saved cache.
+//
+static const char* CacheHeader = "hagelin-drum-cache 1";
+
+using std::lock_guard;
+using std::mutex;
+
+
+void DrumCache::SortWheels(const NumArrayType& NumArray,
+                           array<int, WHEELS>& perm, NumArrayType& sorted) {
+  for (int i=0; i<WHEELS; ++i) {
+    perm[i] = i;
+  }
+  stable_sort(perm.begin(), perm.end(),
+              [&NumArray](int a, int b) {return NumArray[a] < NumArray[b];});
+  for (int c=0; c<WHEELS; ++c) {
+    sorted[c] = NumArray[perm[c]];
+  }
+}
+
+
+vector<DrumCache::Overlaps>
+DrumCache::Lookup(const NumArrayType& NumArray, int& tries,
+                  const SearchFunction& search,
+                  const std::atomic<bool>* cancel) {
+  // Wheel perm[c] of the request is wheel c of the sorted NumArray.
+  array<int, WHEELS> perm;
+  NumArrayType sorted;
+  SortWheels(NumArray, perm, sorted);
+
+  const Entry* entry;
+  {
+    lock_guard<mutex> lock(Mutex);
+    auto itr = Entries.find(sorted);
+    entry = (itr == Entries.end()) ? nullptr : &itr->second;
+  }
+  if (!entry) {
+    // Search without holding the lock so that other threads can use the
+    // cache meanwhile. If two threads search for the same NumArray the
+    // first result stored is kept; both are the same.
+    Entry found = search(sorted);
+    if (cancel && *cancel) {
+      tries = found.tries;
+      return vector<Overlaps>();
+    }
+    lock_guard<mutex> lock(Mutex);
+    entry = &Entries.insert(std::make_pair(sorted, found)).first->second;
+  }
+  // Entries are never removed while in use, and map nodes don't move.
+  tries = entry->tries;
+
+  array<int, PAIRS> pair_map;
+  for (int a=0; a<WHEELS; ++a) {
+    for (int b=a+1; b<WHEELS; ++b) {
+      int i = std::min(perm[a], perm[b]);
+      int j = std::max(perm[a], perm[b]);
+      pair_map[PairIndex(a, b)] = PairIndex(i, j);
+    }
+  }
+  vector<Overlaps> ret(entry->overlaps.size());
+  for (size_t n=0; n<ret.size(); ++n) {
+    for (int p=0; p<PAIRS; ++p) {
+      ret[n][pair_map[p]] = entry->overlaps[n][p];
+    }
+  }
+  // The search visits the drums in lexicographic order of their overlaps.
+  sort(ret.begin(), ret.end());
+  return ret;
+}
+
+
+size_t DrumCache::size(void) const {
+  lock_guard<mutex> lock(Mutex);
+  return Entries.size();
+}
+
+
+void DrumCache::clear(void) {
+  lock_guard<mutex> lock(Mutex);
+  Entries.clear();
+}
+
+
+void DrumCache::Save(ostream& os) const {
+  lock_guard<mutex> lock(Mutex);
+  os << CacheHeader << "\n";
+  for (auto& e : Entries) {
+    for (int i=0; i<WHEELS; ++i) {
+      os << e.first[i] << " ";
+    }
+    os << e.second.tries << " " << e.second.overlaps.size() << "\n";
+    for (auto& o : e.second.overlaps) {
+      for (int p=0; p<PAIRS; ++p) {
+        os << int(o[p]) << ((p == PAIRS-1) ? "\n" : " ");
+      }
+    }
+  }
+}
+
+
+void DrumCache::Load(istream& is) {
+  string header;
+  getline(is, header);
+  if (header != CacheHeader) {
+    throw std::runtime_error("DrumCache::Load(): not a drum cache");
+  }
+  map<NumArrayType, Entry> loaded;
+  NumArrayType NumArray;
+  while (is >> NumArray[0]) {
+    Entry entry;
+    size_t count;
+    for (int i=1; i<WHEELS; ++i) {
+      is >> NumArray[i];
+    }
+    is >> entry.tries >> count;
+    entry.overlaps.resize(count);
+    for (size_t n=0; n<count; ++n) {
+      for (int p=0; p<PAIRS; ++p) {
+        int used;
+        is >> used;
+        entry.overlaps[n][p] = used;
+      }
+    }
+    if (!is) {
+      throw std::runtime_error("DrumCache::Load(): truncated drum cache");
+    }
+    loaded[NumArray] = entry;
+  }
+  lock_guard<mutex> lock(Mutex);
+  Entries.insert(loaded.begin(), loaded.end());
+}
+
+
+bool DrumCache::Save(const string& fname) const {
+  ofstream os(fname);
+  if (!os) {
+    return false;
+  }
+  Save(os);
+  return true;
+}
+
+
+bool DrumCache::Load(const string& fname) {
+  ifstream is(fname);
+  if (!is) {
+    return false;
+  }
+  Load(is);
+  return true;
+}
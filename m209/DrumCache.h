@@ -0,0 +1,167 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCache.h
+ * \brief Definition of the DrumCache class.
+ * \package hagelin
+ */
+
+#ifndef _DRUMCACHE_H_
+#define _DRUMCACHE_H_
+
+#include <array>
+using std::array;
+#include <vector>
+using std::vector;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+#include <iostream>
+using std::istream;
+using std::ostream;
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+
+/*!
+ * \brief Cache of the lug overlaps found by GoodDrums for each NumArray.
+ *
+ * A good drum is determined by its NumArray and by the number of bars
+ * with lugs on both wheels of each pair of wheels. Shuffling a NumArray
+ * only relabels the wheels, so results are stored once for the sorted
+ * NumArray and mapped back to the order requested. They are returned in
+ * the order the search itself would produce, so a cached lookup gives
+ * exactly the same keys as a fresh search.
+ *
+ * The cache may be shared by several threads, and may be saved to and
+ * loaded from a file.
+ */
+class DrumCache {
+
+public:
+
+    //! Number of key wheels.
+    //
+    static const int WHEELS = 6;
+
+    //! Number of pairs of key wheels.
+    //
+    static const int PAIRS = WHEELS * (WHEELS - 1) / 2;
+
+    typedef array<int, WHEELS> NumArrayType;
+
+    //! Number of overlapping bars for each pair of wheels, in the order
+    //! (0,1), (0,2), ... (0,5), (1,2), ... (4,5).
+    //
+    typedef array<unsigned char, PAIRS> Overlaps;
+
+    //! Result of a search for the good drums of one NumArray.
+    //
+    struct Entry {
+      vector<Overlaps>  overlaps;   //!< overlaps of each good drum, in search order
+      int               tries;      //!< number of branches of the search visited,
+                                    //!< including those pruned
+    };
+
+    typedef std::function<Entry(const NumArrayType&)> SearchFunction;
+
+    //! Called with the overlaps and score of each good drum in turn.
+    //
+    typedef std::function<void(const Overlaps&, int)> VisitFunction;
+
+    //! Return the position of pair (i,j), i < j, in Overlaps.
+    //
+    static int PairIndex(int i, int j) {
+      return i * (2 * WHEELS - i - 1) / 2 + (j - i - 1);
+    }
+
+    //! Return the score of a drum: the number of pairs of wheels with
+    //! overlapping bars.
+    //
+    static int Score(const Overlaps& overlaps) {
+      int score = 0;
+      for (auto used : overlaps) {
+        score += used > 0;
+      }
+      return score;
+    }
+
+    //! Sort the wheels by their entry in NumArray.
+
+    //! On return sorted[c] == NumArray[perm[c]], in ascending order, so
+    //! wheel c of sorted is wheel perm[c] of NumArray.
+    //
+    static void SortWheels(const NumArrayType& NumArray,
+                           array<int, WHEELS>& perm, NumArrayType& sorted);
+
+    //! Return the overlaps of the good drums for NumArray.
+
+    //! On a miss, search is called with the sorted NumArray and the
+    //! result is stored. The overlaps returned are relabelled for
+    //! NumArray and in the order a search of NumArray would give them.
+    //! tries is that of the search of the sorted NumArray.
+    //! If cancel is given and is set when the search returns, the search
+    //! is taken to be incomplete: nothing is stored and no overlaps are
+    //! returned.
+    //
+    vector<Overlaps> Lookup(const NumArrayType& NumArray, int& tries,
+                            const SearchFunction& search,
+                            const std::atomic<bool>* cancel = nullptr);
+
+    //! Number of NumArrays in the cache.
+    //
+    size_t size(void) const;
+
+    //! Remove all entries. Must not be called while lookups are running.
+    //
+    void clear(void);
+
+    //! Write the cache to os.
+    //
+    void Save(ostream& os) const;
+
+    //! Add the entries read from is to the cache.
+
+    //! Throws std::runtime_error if the data is malformed.
+    //
+    void Load(istream& is);
+
+    //! Write the cache to file fname. Returns false if it can't be opened.
+    //
+    bool Save(const string& fname) const;
+
+    //! Load the cache from file fname. Returns false if it can't be opened.
+    //
+    bool Load(const string& fname);
+
+private:
+
+    //! Search results keyed by sorted NumArray.
+    //
+    map<NumArrayType, Entry>  Entries;
+
+    //! Guards Entries.
+    //
+    mutable std::mutex        Mutex;
+};
+
+#endif // _DRUMCACHE_H_
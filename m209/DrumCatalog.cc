@@ -0,0 +1,199 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCatalog.cc
+ * \brief Implementation of DrumCatalog class member functions.
+ * \package hagelin
+ */
+
+#include <cstring>
+#include <fstream>
+using std::ofstream;
+#include <algorithm>
+using std::stable_sort;
+#include <stdexcept>
+
+#include "DrumCatalog.h"
+
+//! First bytes of a catalog file.
+//
+static const char CatalogMagic[8] = {'H', 'G', 'L', 'D', 'R', 'U', 'M', '1'};
+
+//! Size of the file header.
+//
+static const size_t HeaderSize = sizeof(CatalogMagic) + 2 * sizeof(uint32_t);
+
+static_assert(sizeof(DrumCatalog::Entry) == 20, "DrumCatalog::Entry is padded");
+
+using namespace boost::interprocess;
+
+
+DrumCatalog::DrumCatalog(const string& fname) {
+  try {
+    File = file_mapping(fname.c_str(), read_only);
+    Region = mapped_region(File, read_only);
+  } catch (interprocess_exception& e) {
+    throw std::runtime_error("DrumCatalog: can't map " + fname + ": " + e.what());
+  }
+  const uint8_t* base = static_cast<const uint8_t*>(Region.get_address());
+  size_t length = Region.get_size();
+  uint32_t bars, entries;
+  if (length < HeaderSize
+      || memcmp(base, CatalogMagic, sizeof(CatalogMagic)) != 0) {
+    throw std::runtime_error("DrumCatalog: " + fname + " is not a drum catalog");
+  }
+  memcpy(&bars, base + sizeof(CatalogMagic), sizeof(bars));
+  memcpy(&entries, base + sizeof(CatalogMagic) + sizeof(bars), sizeof(entries));
+  if (bars != CIPHER_BARS
+      || length < HeaderSize + size_t(entries) * sizeof(Entry)) {
+    throw std::runtime_error("DrumCatalog: " + fname + " is malformed");
+  }
+  NumEntries = entries;
+  Entries = reinterpret_cast<const Entry*>(base + HeaderSize);
+  Drums = base + HeaderSize + NumEntries * sizeof(Entry);
+  size_t num_drums = (length - HeaderSize - NumEntries * sizeof(Entry)) / DRUM_BYTES;
+  for (size_t e=0; e<NumEntries; ++e) {
+    if (Entries[e].candidates > Entries[e].count
+        || Entries[e].first + uint64_t(Entries[e].count) > num_drums) {
+      throw std::runtime_error("DrumCatalog: " + fname + " is truncated");
+    }
+  }
+}
+
+
+const DrumCatalog::Entry* DrumCatalog::Find(const NumArrayType& sorted) const {
+  auto less = [](const Entry& e, const NumArrayType& key) {
+    for (int i=0; i<DrumCache::WHEELS; ++i) {
+      if (e.NumArray[i] != key[i])
+        return e.NumArray[i] < key[i];
+    }
+    return false;
+  };
+  const Entry* itr = std::lower_bound(Entries, Entries + NumEntries, sorted, less);
+  if (itr == Entries + NumEntries)
+    return nullptr;
+  for (int i=0; i<DrumCache::WHEELS; ++i) {
+    if (itr->NumArray[i] != sorted[i])
+      return nullptr;
+  }
+  return itr;
+}
+
+
+DrumCatalog::Bars DrumCatalog::Drum(const Entry& entry, size_t n) const {
+  const uint8_t* packed = Drums + (entry.first + n) * DRUM_BYTES;
+  Bars bars;
+  for (int b=0; b<CIPHER_BARS; ++b) {
+    int bit = b * DrumCache::WHEELS;
+    unsigned word = packed[bit / 8] | (bit / 8 + 1 < DRUM_BYTES ? packed[bit / 8 + 1] << 8 : 0);
+    bars[b] = (word >> (bit % 8)) & 0x3f;
+  }
+  return bars;
+}
+
+
+DrumCatalog::Bars DrumCatalog::Layout(const NumArrayType& NumArray,
+                                      const DrumCache::Overlaps& overlaps) {
+  NumArrayType num = NumArray;
+  Bars bars;
+  int j = 0;
+  for (int i1=0; i1<DrumCache::WHEELS; ++i1) {
+    for (int i2=i1+1; i2<DrumCache::WHEELS; ++i2) {
+      for (int i=0; i<overlaps[DrumCache::PairIndex(i1, i2)]; ++i) {
+        bars.at(j++) = (1 << i1) | (1 << i2);
+        num[i1]--;
+        num[i2]--;
+      }
+    }
+  }
+  for (int l=0; l<DrumCache::WHEELS; ++l) {
+    for (int i=0; i<num[l]; ++i) {
+      bars.at(j++) = 1 << l;
+    }
+  }
+  if (j != CIPHER_BARS)
+    throw std::runtime_error("DrumCatalog::Layout: wrong number of bars");
+  return bars;
+}
+
+
+bool DrumCatalog::Write(const string& fname,
+                        const map<NumArrayType, vector<DrumCache::Overlaps> >& drums) {
+  ofstream os(fname, std::ios::binary);
+  if (!os) {
+    return false;
+  }
+  uint32_t bars = CIPHER_BARS;
+  uint32_t entries = static_cast<uint32_t>(drums.size());
+  os.write(CatalogMagic, sizeof(CatalogMagic));
+  os.write(reinterpret_cast<const char*>(&bars), sizeof(bars));
+  os.write(reinterpret_cast<const char*>(&entries), sizeof(entries));
+
+  // Order the drums of each NumArray best score first, keeping the search
+  // order among equal scores.
+  typedef std::pair<int, const DrumCache::Overlaps*> Scored;
+  vector<vector<Scored> > ordered;
+  uint32_t first = 0;
+  for (auto& d : drums) {
+    vector<Scored> scored;
+    for (auto& o : d.second) {
+      int score = 0;
+      for (int p=0; p<DrumCache::PAIRS; ++p) {
+        score += o[p] > 0;
+      }
+      scored.push_back(Scored(score, &o));
+    }
+    stable_sort(scored.begin(), scored.end(),
+                [](const Scored& a, const Scored& b) {return a.first > b.first;});
+    uint32_t num_best = 0;
+    for (auto& s : scored) {
+      num_best += s.first == scored.front().first;
+    }
+    Entry entry;
+    memset(&entry, 0, sizeof(entry));
+    for (int i=0; i<DrumCache::WHEELS; ++i) {
+      entry.NumArray[i] = static_cast<int8_t>(d.first[i]);
+    }
+    entry.first = first;
+    entry.count = static_cast<uint32_t>(scored.size());
+    entry.candidates = std::min(entry.count,
+                                std::max(uint32_t(MIN_CANDIDATES), num_best));
+    os.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    first += entry.count;
+    ordered.push_back(scored);
+  }
+
+  auto o_itr = ordered.begin();
+  for (auto& d : drums) {
+    for (auto& s : *o_itr++) {
+      Bars b = Layout(d.first, *s.second);
+      uint8_t packed[DRUM_BYTES] = {0};
+      for (int i=0; i<CIPHER_BARS; ++i) {
+        int bit = i * DrumCache::WHEELS;
+        unsigned word = unsigned(b[i]) << (bit % 8);
+        packed[bit / 8] |= word & 0xff;
+        if (word >> 8)
+          packed[bit / 8 + 1] |= word >> 8;
+      }
+      os.write(reinterpret_cast<const char*>(packed), DRUM_BYTES);
+    }
+  }
+  return bool(os);
+}
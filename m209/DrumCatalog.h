@@ -0,0 +1,146 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file DrumCatalog.h
+ * \brief Definition of the DrumCatalog class.
+ * \package hagelin
+ */
+
+#ifndef _DRUMCATALOG_H_
+#define _DRUMCATALOG_H_
+
+#include <cstdint>
+#include <array>
+using std::array;
+#include <vector>
+using std::vector;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "DrumCache.h"
+
+
+/*!
+ * \brief Precomputed good drums for every NumArray, read from a file.
+ *
+ * The M209 drum and the 27 cipher bars of the C52 drum obey the same
+ * rules, so one catalog serves both machines. For each sorted NumArray
+ * the catalog holds the cipher bars of every good drum, best score
+ * first, and the number of candidates GenKey chooses from: the best
+ * scoring drums, or the best 25 if there are fewer of those.
+ *
+ * The file is mapped into memory rather than read, and a drum is found
+ * with a binary search of the NumArrays and then a direct index.
+ *
+ * File layout, in native byte order:
+ *  - header: "HGLDRUM1", uint32 bars per drum (27), uint32 number of
+ *    NumArrays
+ *  - one Entry per NumArray, sorted by NumArray
+ *  - the drums, each 27 six bit bars packed into 21 bytes, bar b in
+ *    bits 6b to 6b+5 counting from the low bit of the first byte.
+ */
+class DrumCatalog {
+
+public:
+
+    //! Number of cipher bars on a drum.
+    //
+    static const int CIPHER_BARS = 27;
+
+    //! Bytes used by the packed bars of one drum.
+    //
+    static const int DRUM_BYTES = (CIPHER_BARS * DrumCache::WHEELS + 7) / 8;
+
+    //! Least number of candidates GenKey chooses from, if there are enough.
+    //
+    static const int MIN_CANDIDATES = 25;
+
+    typedef DrumCache::NumArrayType NumArrayType;
+
+    //! Cipher bars of a drum, bit i of each for wheel i.
+    //
+    typedef array<unsigned char, CIPHER_BARS> Bars;
+
+    //! Index record for one NumArray.
+    //
+    struct Entry {
+      int8_t    NumArray[DrumCache::WHEELS];  //!< sorted NumArray
+      uint8_t   unused[2];
+      uint32_t  first;        //!< index of its first drum
+      uint32_t  count;        //!< number of good drums
+      uint32_t  candidates;   //!< number of drums GenKey chooses from
+    };
+
+    //! Map the catalog in file fname. Throws std::runtime_error if it
+    //! can't be read or isn't a valid catalog.
+    //
+    explicit DrumCatalog(const string& fname);
+
+    //! Number of NumArrays in the catalog.
+    //
+    size_t size(void) const {
+      return NumEntries;
+    }
+
+    //! Find the entry for a sorted NumArray. Returns nullptr if absent.
+    //
+    const Entry* Find(const NumArrayType& sorted) const;
+
+    //! Return drum n of entry, 0 <= n < entry.count.
+    //
+    Bars Drum(const Entry& entry, size_t n) const;
+
+    //! Lay out the cipher bars given by NumArray and overlaps: the
+    //! overlapping bars pair by pair, then single lugs wheel by wheel.
+    //
+    static Bars Layout(const NumArrayType& NumArray,
+                       const DrumCache::Overlaps& overlaps);
+
+    //! Write a catalog to file fname.
+
+    //! drums maps each sorted NumArray to the overlaps of its good drums.
+    //! Returns false if the file can't be written.
+    //
+    static bool Write(const string& fname,
+                      const map<NumArrayType, vector<DrumCache::Overlaps> >& drums);
+
+private:
+
+    boost::interprocess::file_mapping   File;
+    boost::interprocess::mapped_region  Region;
+
+    //! Number of NumArrays.
+    //
+    size_t          NumEntries;
+
+    //! Index, in the mapped file.
+    //
+    const Entry*    Entries;
+
+    //! Packed drums, in the mapped file.
+    //
+    const uint8_t*  Drums;
+};
+
+#endif // _DRUMCATALOG_H_
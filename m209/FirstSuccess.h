@@ -0,0 +1,180 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file FirstSuccess.h
+ * \brief Definition of the FirstSuccess function template.
+ * \package hagelin
+ */
+
+#ifndef _FIRSTSUCCESS_H_
+#define _FIRSTSUCCESS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*!
+ * \brief Search candidates on several threads and return the first one,
+ *        in the order drawn, for which the search succeeds.
+ *
+ * draw is only called on the calling thread, and the candidates are
+ * drawn in the order a serial loop would draw them. How many are drawn
+ * past the one returned depends on the timing of the threads, so if the
+ * caller's results must be reproducible, candidate n should come from
+ * its own random stream rather than a generator the caller goes on to
+ * use. Up to jobs searches run at once on their
+ * own threads. Once a search succeeds the searches of later candidates
+ * can't matter, so their cancel flags are set; search should check its
+ * flag now and then and give up when it is set. The candidate returned is
+ * the one a serial loop over the same draws would stop at, so the result
+ * has the same distribution as the serial loop, only sooner.
+ *
+ * With jobs <= 1 the candidates are searched one at a time on the calling
+ * thread. If the search of a candidate before the first success throws,
+ * the exception is rethrown on the calling thread, as the serial loop
+ * would have thrown it.
+ */
+template<class Candidate, class Result>
+void FirstSuccess(unsigned jobs,
+                  const std::function<Candidate()>& draw,
+                  const std::function<bool(const Candidate&, Result&,
+                                           const std::atomic<bool>&)>& search,
+                  Candidate& candidate, Result& result) {
+  if (jobs <= 1) {
+    std::atomic<bool> cancel{false};
+    do {
+      candidate = draw();
+    } while (!search(candidate, result, cancel));
+    return;
+  }
+  
+  enum State {WAITING, RUNNING, FAILED, FOUND, ERROR};
+  struct Slot {
+    Candidate           candidate;
+    Result              result;
+    std::atomic<bool>   cancel{false};
+    State               state = WAITING;
+    std::exception_ptr  error;
+  };
+  std::deque<std::unique_ptr<Slot> > slots;   // oldest draw first
+  std::mutex slot_mutex;
+  std::condition_variable changed;
+  size_t finished = 0;
+  bool stop = false;
+  
+  auto Worker = [&]() {
+    std::unique_lock<std::mutex> lock(slot_mutex);
+    for (;;) {
+      Slot* slot = nullptr;
+      changed.wait(lock, [&]() {
+        for (auto& s : slots) {
+          if (s->state == WAITING) {
+            slot = s.get();
+            break;
+          }
+        }
+        return stop || slot;
+      });
+      if (stop)
+        return;
+      slot->state = RUNNING;
+      lock.unlock();
+      State state;
+      try {
+        state = !slot->cancel &&
+                search(slot->candidate, slot->result, slot->cancel)
+                ? FOUND : FAILED;
+      } catch (...) {
+        slot->error = std::current_exception();
+        state = ERROR;
+      }
+      lock.lock();
+      slot->state = state;
+      ++finished;
+      changed.notify_all();
+    }
+  };
+  
+  std::vector<std::thread> workers;
+  for (unsigned j = 0; j < jobs; ++j) {
+    workers.push_back(std::thread(Worker));
+  }
+  
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(slot_mutex);
+    for (;;) {
+      while (!slots.empty() && slots.front()->state == FAILED) {
+        slots.pop_front();
+      }
+      if (!slots.empty() &&
+          (slots.front()->state == FOUND || slots.front()->state == ERROR)) {
+        break;
+      }
+      // Only the candidates before the first one found can still beat it.
+      // Until one is found keep jobs searches going.
+      bool found = false;
+      size_t active = 0;
+      for (auto& s : slots) {
+        if (found) {
+          s->cancel = true;
+        } else {
+          found = s->state == FOUND || s->state == ERROR;
+          active += s->state == WAITING || s->state == RUNNING;
+        }
+      }
+      for ( ; !found && active < jobs; ++active) {
+        slots.push_back(std::unique_ptr<Slot>(new Slot));
+        slots.back()->candidate = draw();
+      }
+      changed.notify_all();
+      size_t seen = finished;
+      changed.wait(lock, [&]() { return finished != seen; });
+    }
+    
+    Slot& first = *slots.front();
+    if (first.state == ERROR) {
+      error = first.error;
+    } else {
+      candidate = first.candidate;
+      result = std::move(first.result);
+    }
+    for (auto& s : slots) {
+      s->cancel = true;
+    }
+    stop = true;
+  }
+  changed.notify_all();
+  for (auto& w : workers) {
+    w.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+#endif /* _FIRSTSUCCESS_H_ */
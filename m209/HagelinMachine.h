@@ -0,0 +1,362 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file HagelinMachine.h
+ * \brief Definition of the HagelinMachine class template.
+ * \package hagelin
+ */
+
+#ifndef _HAGELINMACHINE_H_
+#define _HAGELINMACHINE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <bitset>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+
+#include "CipherKernel.h"
+#include "SumCoverage.h"
+#include "DrumCache.h"
+#include "Context.h"
+
+
+/// Stepping of the M209: every code wheel advances one position per letter.
+struct UniformStep {
+  static const bool Irregular = false;
+};
+
+/// Stepping of the C52: the first code wheel advances every letter and
+/// wheel i when bar i-1 has a lug opposite an active pin. These stepping
+/// bars don't count toward the key.
+struct BarStep {
+  static const bool Irregular = true;
+};
+
+/// Key of the M209: the key is subtracted from the letter.
+struct SubtractiveKey {
+  /// Additive kernel key for a key of bars, c - bars == c + (52 - bars)
+  /// modulo 26. The M209 has no print offset.
+  static int Key(int bars, int) {
+    return CipherKernel::MAX_KEY - bars;
+  }
+};
+
+/// Key of the C52: the key and the print offset are added to the letter.
+struct AdditiveKey {
+  /// Additive kernel key for a key of bars and a print offset
+  static int Key(int bars, int offset) {
+    return bars + offset;
+  }
+};
+
+
+/*!
+ * \brief The cipher engine shared by the M209 and the C52.
+ *
+ * A machine with NumBars lug bars and NumWheels code wheels is fully
+ * described by how its wheels step and how its key is applied. Everything
+ * that depends on the drum is folded into a table indexed by the mask of
+ * the pins read, bit i for wheel i, giving the key value of the cipher
+ * bars and the wheels that advance. The keystream loops then only read
+ * pins, look up the table and step the wheels.
+ *
+ * The loops take the wheel size as a template argument too. With the
+ * default of 0 the sizes are read from WheelState; a machine whose wheels
+ * all have the same size, like the CX-52, can pass it so that the wheel
+ * positions wrap at a constant.
+ */
+template<size_t NumBars, size_t NumWheels, class StepPolicy, class KeyPolicy>
+class HagelinMachine {
+public:
+  
+  static_assert(NumWheels < 8, "HagelinMachine: too many wheels");
+  
+  //! Number of bars which step the wheels rather than add to the key.
+  //
+  static const size_t STEP_BARS = StepPolicy::Irregular ? NumWheels-1 : 0;
+  
+  typedef std::array<std::bitset<NumWheels>, NumBars> DrumType;
+  
+  /// Key value of the cipher bars and the wheels which step for a mask
+  /// of the pins read
+  struct KeyStep {
+    unsigned char key;   ///< cipher bars with an active lug
+    unsigned char step;  ///< bit i set if wheel i advances
+  };
+  
+  typedef std::array<KeyStep, 1 << NumWheels> KeyStepTable;
+  
+  /*!
+   * \brief The code wheels as the keystream loops see them.
+   *
+   * Loaded from the wheels of a machine, advanced by the loops, and
+   * stored back by rotating the wheels by the positions moved.
+   */
+  struct WheelState {
+    uint64_t  pins[NumWheels];    ///< packed pins of each wheel
+    int       size[NumWheels];    ///< size of each wheel
+    int       read[NumWheels];    ///< index of the pin read
+    int       moved[NumWheels];   ///< positions moved, modulo size
+    
+    /// Load the state of wheels
+    template<class Wheels>
+    void Load(const Wheels& wheels) {
+      for (size_t i=0; i<NumWheels; i++) {
+        pins[i] = wheels[i].GetPins();
+        size[i] = wheels[i].GetWheelSize();
+        read[i] = wheels[i].GetReadPos();
+        moved[i] = 0;
+      }
+    }
+    
+    /// Turn wheels by the positions moved since Load or the last Store
+    template<class Wheels>
+    void Store(Wheels& wheels) {
+      for (size_t i=0; i<NumWheels; i++) {
+        wheels[i].Rotate(moved[i]);
+        moved[i] = 0;
+      }
+    }
+    
+    /// Mask of the pins read, bit i for wheel i
+    unsigned Pins(void) const {
+      unsigned mask = 0;
+      for (size_t i=0; i<NumWheels; i++) {
+        mask |= unsigned((pins[i] >> read[i]) & 1) << i;
+      }
+      return mask;
+    }
+    
+    /// Advance the wheels set in step by one position
+    template<int WheelSize>
+    void Step(unsigned step) {
+      for (size_t i=0; i<NumWheels; i++) {
+        const int wrap = WheelSize ? WheelSize : size[i];
+        if ((step >> i) & 1) {
+          if (++read[i] == wrap) read[i] = 0;
+          if (++moved[i] == wrap) moved[i] = 0;
+        }
+      }
+    }
+  };
+  
+  
+  /// Compute the KeyStep of every pin mask for drum
+  static void BuildKeyTable(const DrumType& drum, KeyStepTable& table) {
+    for (unsigned mask=0; mask<table.size(); mask++) {
+      std::bitset<NumWheels> pins(mask);
+      int key = 0;
+      for (size_t j=STEP_BARS; j<NumBars; j++) {
+        key += (drum[j] & pins).any();
+      }
+      unsigned step = (1 << NumWheels) - 1;
+      if (StepPolicy::Irregular) {
+        // The first code wheel advances every time.
+        step = 1;
+        for (size_t i=1; i<NumWheels; i++) {
+          if ((drum[i-1] & pins).any()) {
+            step |= 1 << i;
+          }
+        }
+      }
+      table[mask].key = key;
+      table[mask].step = step;
+    }
+  }
+  
+  /// Validate that the cipher bars of drum can produce every key value
+  static bool ValidateDrum(const DrumType& drum) {
+    std::array<uint32_t, NumWheels> WheelBars;
+    WheelBars.fill(0);
+    for (size_t j=STEP_BARS; j<NumBars; ++j) {
+      for (size_t i=0; i<NumWheels; ++i)
+        WheelBars[i] |= uint32_t(drum[j][i]) << (j-STEP_BARS);
+    }
+    return CoversAllSums(WheelBars, NumBars-STEP_BARS);
+  }
+  
+  /// Fill key with the key values of the cipher bars for length letters
+  /// and advance state past them
+  template<int WheelSize = 0>
+  static void Keystream(const KeyStepTable& table, WheelState& state,
+                        size_t length, unsigned char* key) {
+    if (!StepPolicy::Irregular) {
+      // Every wheel steps, so only the pins read need to follow each
+      // letter.
+      for (size_t n=0; n<length; n++) {
+        key[n] = table[state.Pins()].key;
+        for (size_t i=0; i<NumWheels; i++) {
+          const int wrap = WheelSize ? WheelSize : state.size[i];
+          if (++state.read[i] == wrap) state.read[i] = 0;
+        }
+      }
+      for (size_t i=0; i<NumWheels; i++) {
+        const int wrap = WheelSize ? WheelSize : state.size[i];
+        state.moved[i] = (state.moved[i] + length % wrap) % wrap;
+      }
+      return;
+    }
+    for (size_t n=0; n<length; n++) {
+      const KeyStep& entry = table[state.Pins()];
+      key[n] = entry.key;
+      state.template Step<WheelSize>(entry.step);
+    }
+  }
+  
+  /// Advance state past letters without computing their keys. Uniform
+  /// stepping is a closed form; irregular stepping still goes letter by
+  /// letter.
+  template<int WheelSize = 0>
+  static void Skip(const KeyStepTable& table, WheelState& state,
+                   uint64_t letters) {
+    if (!StepPolicy::Irregular) {
+      for (size_t i=0; i<NumWheels; i++) {
+        const int wrap = WheelSize ? WheelSize : state.size[i];
+        int n = letters % wrap;
+        state.read[i] = (state.read[i] + n) % wrap;
+        state.moved[i] = (state.moved[i] + n) % wrap;
+      }
+      return;
+    }
+    for (uint64_t n=0; n<letters; n++) {
+      state.template Step<WheelSize>(table[state.Pins()].step);
+    }
+  }
+  
+  /// Encipher/decipher length letters from in to out with the key values
+  /// in key, which are replaced by the kernel keys. 0 <= offset < 26.
+  static void Apply(const char* in, unsigned char* key, size_t length,
+                    int offset, char* out) {
+    for (size_t n=0; n<length; n++) {
+      key[n] = KeyPolicy::Key(key[n], offset);
+    }
+    CipherKernel::Apply(in, key, length, out);
+  }
+  
+  /// Digits of the wheels a bar has lugs on, as printed in a key: '0'
+  /// and '0' for none, '0' and the wheel for one, or the two wheels in
+  /// order. Throws std::runtime_error if the bar has more than two lugs.
+  static void BarLugs(std::bitset<NumWheels> bar, char& a1, char& a2) {
+    char lugs[2] = {'0', '0'};
+    size_t n = 0;
+    for (size_t i=0; i<NumWheels; ++i) {
+      if (bar[i]) {
+        if (n == 2)
+          throw std::runtime_error("HagelinMachine::BarLugs: More than two lugs present.");
+        lugs[n++] = '1' + i;
+      }
+    }
+    a1 = n == 2 ? lugs[0] : '0';
+    a2 = n == 2 ? lugs[1] : lugs[0];
+  }
+  
+  /// Compare two bars of no more than two lugs by their lugs as printed,
+  /// for sorting
+  static bool CompareBars(std::bitset<NumWheels> a, std::bitset<NumWheels> b) {
+    char a1, a2, b1, b2;
+    BarLugs(a, a1, a2);
+    BarLugs(b, b1, b2);
+    return (int(a1) << 8 | a2) < (int(b1) << 8 | b2);
+  }
+  
+  /// Compare two bars by their lugs read as a number, wheel i being bit
+  /// i, for sorting
+  static bool CompareBarBits(std::bitset<NumWheels> a, std::bitset<NumWheels> b) {
+    return a.to_ulong() < b.to_ulong();
+  }
+  
+  /// Call visit with the overlaps and score of each good drum for
+  /// NumArray, in search order, taking them from cache, which calls
+  /// search the first time any permutation of NumArray is looked up.
+  /// Returns the number of good drums.
+  static size_t GoodDrums(DrumCache& cache,
+                          const std::array<int, NumWheels>& NumArray,
+                          int& tries, const DrumCache::SearchFunction& search,
+                          const DrumCache::VisitFunction& visit) {
+    static_assert(NumWheels == DrumCache::WHEELS,
+                  "HagelinMachine: DrumCache has the wrong number of wheels");
+    std::vector<DrumCache::Overlaps> overlaps =
+      cache.Lookup(NumArray, tries, search);
+    for (auto& o : overlaps) {
+      visit(o, DrumCache::Score(o));
+    }
+    return overlaps.size();
+  }
+  
+  /// Set the wheels to the positions named by count names, one per wheel
+  /// in order. A name that the next wheel has no position for is skipped,
+  /// so extra names allow for unusable indicators. Returns false if names
+  /// run out first. Neither allocates nor throws unless ctx is verbose.
+  template<class Wheels>
+  static bool TrySetPositions(Wheels& wheels, const char* const* names,
+                              size_t count, const Context& ctx) {
+    size_t i = 0;
+    for (size_t j=0; (i<NumWheels) && (j<count); j++) {
+      if (ctx.Verbose) {
+        *ctx.Log << "Trying wheel " << std::dec << i << " setting "
+                 << names[j] << std::endl;
+      }
+      if (wheels[i].TrySetPosByName(names[j])) {
+        ++i;
+      }
+    }
+    
+    if (i < NumWheels) {
+      // Unable to set wheels as requested
+      return false;
+    }
+    
+    if (ctx.Verbose) {
+      *ctx.Log << "Wheels set to: ";
+      for (i=0; i<NumWheels; i++) {
+        *ctx.Log << wheels[i].GetPosName();
+      }
+      *ctx.Log << std::endl;
+    }
+    return true;
+  }
+  
+  /// Same as TrySetPositions, with the names in a vector
+  template<class Wheels>
+  static bool SetPositions(Wheels& wheels,
+                           const std::vector<std::string>& indicator,
+                           const Context& ctx) {
+    std::vector<const char*> names;
+    for (auto& name : indicator) {
+      names.push_back(name.c_str());
+    }
+    return TrySetPositions(wheels, names.data(), names.size(), ctx);
+  }
+  
+  /// Encipher/decipher one letter c, 'A' <= c <= 'Z', with a key value
+  /// of bars and a print offset.
+  static char Cipher(char c, int bars, int offset) {
+    int cnum = ((c - 'A' + KeyPolicy::Key(bars, offset)) % 26 + 26) % 26;
+    // Ciphered letter from the reciprocal alphabet
+    return 'Z' - cnum;
+  }
+};
+
+#endif // _HAGELINMACHINE_H_
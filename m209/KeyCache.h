@@ -0,0 +1,171 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file KeyCache.h
+ * \brief Definition of the KeyCache class template.
+ * \package hagelin
+ */
+
+#ifndef _KEYCACHE_H_
+#define _KEYCACHE_H_
+
+#include <cstddef>
+#include <string>
+using std::string;
+#include <list>
+using std::list;
+#include <map>
+using std::map;
+#include <tuple>
+#include <utility>
+#include <mutex>
+
+
+/*!
+ * \brief Bounded cache of loaded keys, evicting the least recently used.
+ *
+ * State is whatever a machine needs to take up a key again without reading
+ * the key list, e.g. its wheels and drum. Keys are named by the machine,
+ * the key list directory, the net indicator and the day number, and key
+ * lists are assumed not to change while the program runs.
+ *
+ * The cache may be shared by several threads.
+ */
+template<class State>
+class KeyCache {
+
+public:
+
+    //! Name of a key.
+    //
+    struct Key {
+      int     machine;    //!< a KeyRecord::Machine
+      string  dir;        //!< key list directory
+      string  net;        //!< net indicator
+      long    day;        //!< day number of the key
+
+      friend bool operator< (const Key& lhs, const Key& rhs) {
+        return std::tie(lhs.machine, lhs.day, lhs.net, lhs.dir)
+             < std::tie(rhs.machine, rhs.day, rhs.net, rhs.dir);
+      }
+    };
+
+    //! Create a cache holding at most capacity keys.
+    //
+    explicit KeyCache(size_t capacity = 64) : Capacity(capacity) {}
+
+    //! If key is in the cache copy its state to state and return true.
+    //
+    bool Lookup(const Key& key, State& state) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      auto it = Index.find(key);
+      if (it == Index.end()) {
+        ++Misses;
+        return false;
+      }
+      ++Hits;
+      Entries.splice(Entries.begin(), Entries, it->second);
+      state = it->second->second;
+      return true;
+    }
+
+    //! Store state under key, evicting the least recently used key if
+    //! the cache is full.
+    //
+    void Insert(const Key& key, const State& state) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (Capacity == 0)
+        return;
+      auto it = Index.find(key);
+      if (it != Index.end()) {
+        it->second->second = state;
+        Entries.splice(Entries.begin(), Entries, it->second);
+        return;
+      }
+      if (Entries.size() >= Capacity) {
+        Index.erase(Entries.back().first);
+        Entries.pop_back();
+      }
+      Entries.emplace_front(key, state);
+      Index[key] = Entries.begin();
+    }
+
+    //! Number of lookups that found their key.
+    //
+    size_t hits(void) const {
+      std::lock_guard<std::mutex> lock(Mutex);
+      return Hits;
+    }
+
+    //! Number of lookups that didn't.
+    //
+    size_t misses(void) const {
+      std::lock_guard<std::mutex> lock(Mutex);
+      return Misses;
+    }
+
+    //! Number of keys in the cache.
+    //
+    size_t size(void) const {
+      std::lock_guard<std::mutex> lock(Mutex);
+      return Entries.size();
+    }
+
+    //! Change the number of keys held, evicting keys if there are too many.
+    //
+    void SetCapacity(size_t capacity) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Capacity = capacity;
+      for ( ; Entries.size() > Capacity; Entries.pop_back())
+        Index.erase(Entries.back().first);
+    }
+
+    //! Remove all keys and reset the counters.
+    //
+    void clear(void) {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Entries.clear();
+      Index.clear();
+      Hits = Misses = 0;
+    }
+
+private:
+
+    typedef list<std::pair<Key, State> > EntryList;
+
+    //! Cached keys, most recently used first.
+    //
+    EntryList                                   Entries;
+
+    //! Position of each key in Entries.
+    //
+    map<Key, typename EntryList::iterator>      Index;
+
+    size_t              Capacity;
+    size_t              Hits = 0;
+    size_t              Misses = 0;
+
+    //! Guards all of the above.
+    //
+    mutable std::mutex  Mutex;
+};
+
+#endif // _KEYCACHE_H_
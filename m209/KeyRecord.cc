@@ -0,0 +1,158 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file KeyRecord.cc
+ * \brief Implementation of KeyRecord, KeyFile and KeyDataBase member
+ * functions.
+ * \package hagelin
+ */
+
+#include <cstring>
+#include <fstream>
+using std::ofstream;
+#include <stdexcept>
+#include <algorithm>
+
+#include "KeyRecord.h"
+
+//! First bytes of a key file.
+//
+static const char KeyMagic[8] = {'H', 'G', 'L', 'K', 'E', 'Y', '0', '1'};
+
+//! First bytes of a key data base.
+//
+static const char DataBaseMagic[8] = {'H', 'G', 'L', 'K', 'D', 'B', '0', '1'};
+
+static_assert(sizeof(KeyRecord) == 112, "KeyRecord is padded");
+
+using namespace boost::interprocess;
+
+
+string KeyRecord::NetIndicator(void) const {
+  return string(net, strnlen(net, NET_LENGTH));
+}
+
+
+void KeyRecord::SetNetIndicator(const string& NetIndicator) {
+  if (NetIndicator.size() > NET_LENGTH) {
+    throw std::invalid_argument("KeyRecord: net indicator " + NetIndicator
+                                + " is too long");
+  }
+  memset(net, 0, NET_LENGTH);
+  memcpy(net, NetIndicator.data(), NetIndicator.size());
+}
+
+
+KeyFile::KeyFile(const string& fname) {
+  try {
+    File = file_mapping(fname.c_str(), read_only);
+    Region = mapped_region(File, read_only);
+  } catch (interprocess_exception& e) {
+    throw std::runtime_error("KeyFile: can't map " + fname + ": " + e.what());
+  }
+  const char* base = static_cast<const char*>(Region.get_address());
+  if (Region.get_size() < sizeof(KeyMagic) + sizeof(KeyRecord)
+      || memcmp(base, KeyMagic, sizeof(KeyMagic)) != 0) {
+    throw std::runtime_error("KeyFile: " + fname + " is not a key file");
+  }
+  Key = reinterpret_cast<const KeyRecord*>(base + sizeof(KeyMagic));
+  if (Key->bars > KeyRecord::MAX_BARS) {
+    throw std::runtime_error("KeyFile: " + fname + " is malformed");
+  }
+}
+
+
+bool KeyFile::Write(const string& fname, const KeyRecord& record) {
+  ofstream os(fname, std::ios::binary);
+  if (!os)
+    return false;
+  os.write(KeyMagic, sizeof(KeyMagic));
+  os.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  return bool(os);
+}
+
+
+KeyDataBase::KeyDataBase(const string& fname) {
+  try {
+    File = file_mapping(fname.c_str(), read_only);
+    Region = mapped_region(File, read_only);
+  } catch (interprocess_exception& e) {
+    throw std::runtime_error("KeyDataBase: can't map " + fname + ": "
+                             + e.what());
+  }
+  const char* base = static_cast<const char*>(Region.get_address());
+  Head = reinterpret_cast<const Header*>(base);
+  if (Region.get_size() < sizeof(Header)
+      || memcmp(Head->magic, DataBaseMagic, sizeof(DataBaseMagic)) != 0) {
+    throw std::runtime_error("KeyDataBase: " + fname
+                             + " is not a key data base");
+  }
+  if (Region.get_size() < sizeof(Header) + Head->count * sizeof(KeyRecord)) {
+    throw std::runtime_error("KeyDataBase: " + fname + " is truncated");
+  }
+  Keys = reinterpret_cast<const KeyRecord*>(base + sizeof(Header));
+}
+
+
+const KeyRecord* KeyDataBase::Find(long day) const {
+  long n = day - Head->first_day;
+  if (n < 0 || n >= long(Head->count))
+    return nullptr;
+  const KeyRecord* key = Keys + n;
+  if (key->machine != Head->machine || key->bars > KeyRecord::MAX_BARS)
+    return nullptr;
+  return key;
+}
+
+
+bool KeyDataBase::Write(const string& fname, vector<KeyRecord> records) {
+  sort(records.begin(), records.end(),
+       [](const KeyRecord& a, const KeyRecord& b) { return a.day < b.day; });
+  Header head = Header();
+  memcpy(head.magic, DataBaseMagic, sizeof(DataBaseMagic));
+  if (!records.empty()) {
+    head.machine = records.front().machine;
+    head.first_day = records.front().day;
+    head.count = records.back().day - records.front().day + 1;
+  }
+  for (size_t i=0; i<records.size(); ++i) {
+    if (records[i].machine != head.machine || records[i].machine == 0) {
+      throw std::invalid_argument("KeyDataBase: keys for different machines");
+    }
+    if (i > 0 && records[i].day == records[i-1].day) {
+      throw std::invalid_argument("KeyDataBase: two keys for one day");
+    }
+  }
+  
+  ofstream os(fname, std::ios::binary);
+  if (!os)
+    return false;
+  os.write(reinterpret_cast<const char*>(&head), sizeof(head));
+  const KeyRecord none = KeyRecord();
+  int32_t day = head.first_day;
+  for (auto& record : records) {
+    for ( ; day < record.day; ++day)
+      os.write(reinterpret_cast<const char*>(&none), sizeof(none));
+    os.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    ++day;
+  }
+  return bool(os);
+}
@@ -0,0 +1,192 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file KeyRecord.h
+ * \brief Definition of the KeyRecord struct and the KeyFile and KeyDataBase
+ * classes.
+ * \package hagelin
+ */
+
+#ifndef _KEYRECORD_H_
+#define _KEYRECORD_H_
+
+#include <cstdint>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+
+/*!
+ * \brief A key setting of an M209 or a C52 in a fixed binary layout.
+ *
+ * Loading a record needs no parsing: the pins of each wheel are one word
+ * and each lug bar is a mask with bit i for wheel i. The net indicator and
+ * the key list indicator or date of the key go with it.
+ */
+struct KeyRecord {
+
+    //! Number of key wheels.
+    //
+    static const int WHEELS = 6;
+
+    //! Largest number of lug bars on a drum.
+    //
+    static const int MAX_BARS = 32;
+
+    //! Length of the net indicator field.
+    //
+    static const int NET_LENGTH = 16;
+
+    //! Machine the key is for.
+    //
+    enum Machine : uint8_t {
+      M209 = 1,
+      C52 = 2
+    };
+
+    uint8_t   machine;                  //!< a Machine
+    uint8_t   bars;                     //!< number of lug bars on the drum
+    uint8_t   wheel_idx[WHEELS];        //!< wheel in each position
+    char      net[NET_LENGTH];          //!< net indicator, NUL padded
+    char      kli[2];                   //!< M209 key list indicator
+    uint8_t   unused[2];
+    int32_t   day;                      //!< day number of the C52 date
+    uint64_t  pins[WHEELS];             //!< pins of each wheel, bit i for position i
+    uint8_t   lugs[MAX_BARS];           //!< lugs of each bar, bit i for wheel i
+
+    //! Return the net indicator.
+    //
+    string NetIndicator(void) const;
+
+    //! Set the net indicator. Throws std::invalid_argument if it's too long.
+    //
+    void SetNetIndicator(const string& NetIndicator);
+};
+
+
+/*!
+ * \brief A key setting stored in a file as a KeyRecord.
+ *
+ * The file is mapped into memory rather than read.
+ *
+ * File layout, in native byte order: "HGLKEY01", then the KeyRecord.
+ */
+class KeyFile {
+
+public:
+
+    //! Map the key in file fname. Throws std::runtime_error if it can't
+    //! be read or isn't a key file.
+    //
+    explicit KeyFile(const string& fname);
+
+    //! The key.
+    //
+    const KeyRecord& Record(void) const {
+      return *Key;
+    }
+
+    //! Write record to file fname. Returns false if the file can't be
+    //! written.
+    //
+    static bool Write(const string& fname, const KeyRecord& record);
+
+private:
+
+    boost::interprocess::file_mapping   File;
+    boost::interprocess::mapped_region  Region;
+
+    //! The key, in the mapped file.
+    //
+    const KeyRecord*  Key;
+};
+
+
+/*!
+ * \brief The keys of one net for a range of days, in one file.
+ *
+ * Looking up the key of a day is an offset calculation in the mapped
+ * file. Days within the range that have no key are zero records.
+ *
+ * File layout, in native byte order: "HGLKDB01", the machine, three
+ * unused bytes, the day number of the first day, the number of days, four
+ * unused bytes and then one KeyRecord for each day.
+ */
+class KeyDataBase {
+
+public:
+
+    //! Map the data base in file fname. Throws std::runtime_error if it
+    //! can't be read or isn't a key data base.
+    //
+    explicit KeyDataBase(const string& fname);
+
+    //! The key of day number day, or nullptr if there is none.
+    //
+    const KeyRecord* Find(long day) const;
+
+    //! Day number of the first day.
+    //
+    int32_t FirstDay(void) const {
+      return Head->first_day;
+    }
+
+    //! Number of days, including days without a key.
+    //
+    size_t size(void) const {
+      return Head->count;
+    }
+
+    //! Write records, which must be for one machine and on different
+    //! days, to file fname. Returns false if the file can't be written.
+    //! Throws std::invalid_argument if the records don't fit a data base.
+    //
+    static bool Write(const string& fname, vector<KeyRecord> records);
+
+private:
+
+    //! Header of a key data base file.
+    //
+    struct Header {
+      char      magic[8];
+      uint8_t   machine;
+      uint8_t   unused[3];
+      int32_t   first_day;
+      uint32_t  count;
+      uint32_t  unused2;
+    };
+
+    boost::interprocess::file_mapping   File;
+    boost::interprocess::mapped_region  Region;
+
+    //! The header, in the mapped file.
+    //
+    const Header*     Head;
+
+    //! The keys, in the mapped file.
+    //
+    const KeyRecord*  Keys;
+};
+
+#endif // _KEYRECORD_H_
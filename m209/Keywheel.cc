@@ -35,35 +35,91 @@ using std::dec;
 
 
 
+#include <algorithm>
+#include <cstring>
+
 #include "config.h"
 #include "Keywheel.h"
+#include "PinSampler.h"
+
+WheelType::WheelType(const vector<string>& names, int offset) {
+  if (names.size() > size_t(MAX_POSITIONS)) {
+    throw std::invalid_argument(
+                                "WheelType::WheelType(): too many positions");
+  }
+  PosByLetter.fill(-1);
+  for (auto& name : names) {
+    int pos = int(PosNames.size());
+    if (name.size() == 1 && (unsigned char)name[0] < PosByLetter.size()) {
+      if (PosByLetter[name[0]] >= 0) {
+        throw std::invalid_argument(
+                                    "WheelType::WheelType(): duplicate name");
+      }
+      PosByLetter[name[0]] = pos;
+    } else {
+      PosByName.emplace_back(name, pos);
+    }
+    PosNames.push_back(name);
+  }
+  std::sort(PosByName.begin(), PosByName.end());
+  for (size_t i=1; i<PosByName.size(); ++i) {
+    if (PosByName[i].first == PosByName[i-1].first) {
+      throw std::invalid_argument(
+                                  "WheelType::WheelType(): duplicate name");
+    }
+  }
+  ReadOffset = offset;
+}
+
+
+int WheelType::Find(const char* name) const {
+  unsigned char c = name[0];
+  if (c && !name[1] && c < PosByLetter.size()) {
+    return PosByLetter[c];
+  }
+  auto it = std::lower_bound(PosByName.begin(), PosByName.end(), name,
+                             [](const pair<string, int>& a, const char* b) {
+                               return strcmp(a.first.c_str(), b) < 0;
+                             });
+  if (it == PosByName.end() || strcmp(it->first.c_str(), name) != 0) {
+    return -1;
+  }
+  return it->second;
+}
+
 
 Keywheel::Keywheel() {
-  WheelSize = Position = ReadOffset = 0;
+  WheelSize = Position = ReadOffset = ReadPos = 0;
+  Pins = 0;
+  Type = nullptr;
 }
 
 void Keywheel::Clear() {
-  WheelSize = Position = ReadOffset = 0;
-  Pins.clear();
-  PosNames.clear();
-  PosByName.clear();  
+  WheelSize = Position = ReadOffset = ReadPos = 0;
+  Pins = 0;
+  Type = nullptr;
 }
 
 
-void Keywheel::AddPosition(const string& name) {
-  if (PosByName.count(name)) {
-    throw std::invalid_argument(
-                                "Keywheel::AddPosition(): duplicate name");
-  }
-  PosNames.push_back(name);
-  PosByName[name] = WheelSize;
-  WheelSize++;
-  Pins.resize(WheelSize);
+void Keywheel::SetType(const WheelType& type) {
+  Type = &type;
+  WheelSize = type.GetSize();
+  ReadOffset = type.GetReadOffset();
+  Position = 0;
+  Pins = 0;
+  UpdateReadPos();
 }
 
 
-void Keywheel::SetReadOffset(int offset) {
-  ReadOffset = offset;
+void Keywheel::UpdateReadPos(void) {
+  ReadPos = (WheelSize == 0) ? 0 : ReadPosAt(Position);
+}
+
+
+int Keywheel::ReadPosAt(int pos) const {
+  int  p;
+  for (p = pos + ReadOffset; p<0; p += WheelSize);
+  return p % WheelSize;
 }
 
 
@@ -73,16 +129,27 @@ void Keywheel::SetPosition(int pos) {
                                 "Keywheel::SetPosition(): position out of bounds");
   }
   Position = pos;
+  UpdateReadPos();
 }
 
 
 void Keywheel::SetPosByName(const string& name) {
-  if (PosByName.count(name) != 1) {
+  if (!TrySetPosByName(name.c_str())) {
     throw std::invalid_argument(
                                 "Keywheel::SetPosByName(): name not found");
   }
+}
+
+
+bool Keywheel::TrySetPosByName(const char* name) {
+  int pos = Type ? Type->Find(name) : -1;
+  if (pos < 0) {
+    return false;
+  }
   
-  Position = PosByName[name];
+  Position = pos;
+  UpdateReadPos();
+  return true;
 }
 
 
@@ -90,51 +157,54 @@ int Keywheel::Rotate(int num) {
   Position += num;
   for ( ; Position < 0; Position += WheelSize);
   Position %= WheelSize;
+  UpdateReadPos();
   return Position;
 }
 
 
-int Keywheel::GetPosition(void) {
+int Keywheel::GetPosition(void) const {
   return Position;
 }
 
 
-string &Keywheel::GetPosName(void) {
-  return PosNames[Position];
+const string &Keywheel::GetPosName(void) const {
+  return Type->GetName(Position);
 }
 
 
-string &Keywheel::GetOffsetName(void) {
-  int  p;
-  for (p = Position + ReadOffset; p<0; p += WheelSize);
-  return PosNames[p % WheelSize];
+const string &Keywheel::GetOffsetName(void) const {
+  return Type->GetName(ReadPos);
 }
 
 
-int Keywheel::GetWheelSize(void) {
+int Keywheel::GetWheelSize(void) const {
   return WheelSize;
 }
 
 
 bool Keywheel::ReadPin(void) {
-  return Pins[Position];
+  return (Pins >> Position) & 1;
 }
 
 
-bool Keywheel::ReadPinOffset(void) {
-  int  p;
-  for (p = Position + ReadOffset; p<0; p += WheelSize);
-  return Pins[p % WheelSize];
+void Keywheel::SetPin(bool active) {
+  if (active) {
+    Pins |= uint64_t(1) << Position;
+  } else {
+    Pins &= ~(uint64_t(1) << Position);
+  }
 }
 
 
-void Keywheel::SetPin(bool active) {
-  Pins[Position] = active;
+void Keywheel::ClearAllPins(void) {
+  Pins = 0;
 }
 
 
-void Keywheel::ClearAllPins(void) {
-  for (int i=0; i<WheelSize; Pins[i++]=false);
+void Keywheel::SetPins(uint64_t pins) {
+  if (WheelSize < MAX_POSITIONS)
+    pins &= (uint64_t(1) << WheelSize) - 1;
+  Pins = pins;
 }
 
 
@@ -142,7 +212,7 @@ int Keywheel::GetWeight(void) {
   int    i, w;
   
   for (i=0, w=0; i < WheelSize; i++) {
-    if (Pins[i]) {
+    if ((Pins >> i) & 1) {
       ++w;
     }
   }
@@ -152,81 +222,20 @@ int Keywheel::GetWeight(void) {
 
 
 void Keywheel::Randomize(void) {
-  int    i;
-  double  ratio;      // ratio of active/inactive pins
-  int    tries;      // number of attempts to randomize
-  int    c, lastpin;    // used in consecutive pins check
-  int    max_c;      // maximum consecutive pins
-  int    pin;
+  static const PinSampler sampler(6);
   
-  tries = 0;
+  Pins = sampler.Sample(WheelSize, gen);
   
-  do {
-    // Avoid infinite loop
-    if (tries++ >= 100) {
-      cerr << "ERROR: Cannot randomize pins! Is random() broken?" << endl;
-      exit(1);
-    }
-    
-    // Randomize the pins, counting run lengths
-    for (i=0, max_c=1, c=1, lastpin=2; i<WheelSize; i++) {
-      ui_dist u_0_1(0,1);
-      pin = u_0_1(gen);
-      Pins[i] = pin;
-      
-      if (pin == lastpin) {
-        ++c;
-      } else {
-        if (c > max_c) {
-          max_c = c;
-        }
-        c = 1;
-      }
-      lastpin = pin;
-    }
-    
-    if (c > max_c) {
-      max_c = c;
-    }
+  // Print debug information
+  if (Verbose) {
+    cerr << "Wheel " << dec << setw(2) << setfill(' ') << WheelSize
+    << " ratio " << dec << setw(2) << GetWeight() * 100 / WheelSize << "%";
     
-    // If first and last bits equal, look for long overlapping run
-    if (Pins[0] == Pins[WheelSize-1]) {
-      
-      lastpin = Pins[0];
-      
-      // Count right half of run
-      for (c=0; Pins[c] == lastpin; c++);
-      
-      // Count left half of run
-      for (i=WheelSize-1; Pins[i] == lastpin; i--, c++);
-      
-      if (c > max_c) {
-        max_c = c;
-      }
-      
+    cerr << " Pins ";
+    for (int i=0; i<WheelSize; i++) {
+      cerr << ((Pins >> i) & 1);
     }
     
-    // Calculate percentage of active pins
-    ratio = (double)GetWeight() / (double)WheelSize;
-    
-    // Print debug information
-    if (Verbose) {
-      cerr << "Wheel " << dec << setw(2) << setfill(' ') << WheelSize
-      << " try " << dec << setw(2) << setfill(' ') << tries
-      << " ratio " << dec << setw(2) << (int)(ratio*100.0) << "%"
-      << " max run length " << dec << setfill(' ') << max_c;
-      
-      cerr << " Pins ";
-      for (i=0; i<WheelSize; i++) {
-        cerr << Pins[i];
-      }
-      
-      cerr << endl;
-    }
-    
-  } while ((ratio < 0.4) || (ratio > 0.6) || (max_c > 6));
-  
-  
+    cerr << endl;
+  }
 }
-
-
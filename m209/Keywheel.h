@@ -27,18 +27,95 @@
 #ifndef _KEYWHEEL_H_
 #define _KEYWHEEL_H_
 
+#include <cstdint>
 #include <vector>
 using std::vector;
 #include <string>
 using std::string;
-#include <map>
-using std::map;
+#include <array>
+using std::array;
+#include <utility>
+using std::pair;
 
 extern bool Verbose;
 extern bool Quiet;
 
 
 
+/*!
+ * \brief The markings and read offset of one kind of key wheel.
+ *
+ * A wheel type is immutable once made. The machines build one per kind
+ * of wheel when first used, and every Keywheel of that kind refers to
+ * it, so changing the wheels of a machine copies no names.
+ */
+class WheelType {
+
+private:
+
+    //! Names of each position (i.e., "A", "B", "10", "11", etc.).
+    //
+    vector<string>	PosNames;
+
+    //! Position of each one letter name, -1 if there is none.
+    
+    //! Indicators are almost always single letters, so they are looked up
+    //! here directly by character code.
+    //
+    array<signed char, 128>	PosByLetter;
+
+    //! Positions of the other names, sorted by name for binary search.
+    //
+    vector<pair<string, int> >	PosByName;
+
+    //! Offset between indicated position and pin to be read.
+    //
+    int			ReadOffset;
+
+public:
+
+    //! Maximum number of positions on a wheel.
+    //
+    static const int	MAX_POSITIONS = 64;
+
+    //! Make a wheel type from its position names, which must be unique.
+    //
+    //! Throws std::invalid_argument on a duplicate name or more than
+    //! MAX_POSITIONS names.
+    //
+    WheelType(const vector<string>& names, int offset);
+
+    //! Return number of positions.
+    //
+    int GetSize(void) const {
+      return int(PosNames.size());
+    }
+
+    //! Return read offset.
+    //
+    int GetReadOffset(void) const {
+      return ReadOffset;
+    }
+
+    //! Get name of position pos. 0 <= pos < GetSize()
+    //
+    const string &GetName(int pos) const {
+      return PosNames[pos];
+    }
+
+    //! Return the position with the given name, or -1 if there is none.
+    //
+    //! Neither allocates nor throws.
+    //
+    int Find(const char* name) const;
+
+    int Find(const string& name) const {
+      return Find(name.c_str());
+    }
+};
+
+
+
 /*!
  * \brief This class simulates a key wheel in a Hagelin pin-and-lug
  *        cipher machine.
@@ -49,8 +126,11 @@ class Keywheel {
 private:
 
     //! Bitmap of pin state corresponding to each indicated wheel position.
+
+    //! Bit i holds the pin at position i, so a wheel may have at most
+    //! MAX_POSITIONS positions.
     //
-    vector <bool>	Pins;
+    uint64_t		Pins;
 
 
     //! Number of wheel positions (also, number of pins).
@@ -72,16 +152,30 @@ private:
     //
     int			Position;
 
-    //! Names of each key wheel position (i.e., "A", "B", "10", "11", etc.).
+    //! Index of the pin read at the current position.
+
+    //! Always equal to (Position + ReadOffset) modulo WheelSize. It is
+    //! kept up to date as the wheel turns so that reading the pin is a
+    //! single bit extraction.
     //
-    vector<string>	PosNames;
+    int			ReadPos;
 
-    //! Hash allowing decode of position from position name
-    map<string, int>	PosByName;
+    //! Kind of wheel, giving the position names. Null until SetType().
+    //
+    const WheelType*	Type;
+
+
+    //! Recalculate ReadPos from Position and ReadOffset.
+    //
+    void UpdateReadPos(void);
 
 
 public:
 
+    //! Maximum number of positions on a wheel.
+    //
+    static const int	MAX_POSITIONS = WheelType::MAX_POSITIONS;
+
     //! Default constructor
     //
     Keywheel();
@@ -94,14 +188,17 @@ public:
     /// Clear the wheel
     void Clear();
   
-    //! Add position to wheel with specified name (name must be unique).
+    //! Make this a wheel of the given type, at the first position with
+    //! all pins inactive. The type must outlive the wheel.
     //
-    void AddPosition(const string& name);
+    void SetType(const WheelType& type);
 
 
-    //! Set read offset.
+    //! Return the type of the wheel, null if none has been set.
     //
-    void SetReadOffset(int offset);
+    const WheelType* GetType(void) const {
+      return Type;
+    }
 
 
     //! Set wheel to specific position. 0 <= pos < WheelSize
@@ -114,29 +211,51 @@ public:
     void SetPosByName(const string& name);
 
 
+    //! Set wheel to the position with the given name, if there is one.
+    //
+    //! Returns false, leaving the wheel as it was, if there is none.
+    //
+    bool TrySetPosByName(const char* name);
+
+
     //! Rotate wheel by specified number of positions.
 
     int Rotate(int num);
 
 
+    //! Rotate wheel by one position.
+    //
+    void Step(void) {
+      if (++Position == WheelSize) Position = 0;
+      if (++ReadPos == WheelSize) ReadPos = 0;
+    }
+
+
     //! Get current position.
     //
-    int GetPosition(void);
+    int GetPosition(void) const;
 
 
     //! Get name of current position.
     //
-    string &GetPosName(void);
+    const string &GetPosName(void) const;
 
 
     //! Get name of offset position (letter next to pin which will be read)
     //
-    string &GetOffsetName(void);
+    const string &GetOffsetName(void) const;
+
+
+    //! Get name of position pos. 0 <= pos < WheelSize
+    //
+    const string &GetPosNameAt(int pos) const {
+      return Type->GetName(pos);
+    }
 
 
     //! Return wheel size (number of pins).
     //
-    int GetWheelSize(void);
+    int GetWheelSize(void) const;
 
 
     //! Read pin at current indicated position.
@@ -146,8 +265,30 @@ public:
 
     //! Read pin at offset from indicated position.
     //
-    bool ReadPinOffset(void);
-    
+    bool ReadPinOffset(void) const {
+      return (Pins >> ReadPos) & 1;
+    }
+
+
+    //! Return the packed pin settings, bit i for position i.
+    //
+    uint64_t GetPins(void) const {
+      return Pins;
+    }
+
+
+    //! Return the index of the pin read at the current position.
+    //
+    int GetReadPos(void) const {
+      return ReadPos;
+    }
+
+
+    //! Return the index of the pin read when the wheel is at pos.
+    //
+    int ReadPosAt(int pos) const;
+
+
 
     //! Set pin at current indicated position.
     //
@@ -159,10 +300,17 @@ public:
     void ClearAllPins(void);
 
 
+    //! Set all pins at once, bit i for position i. Bits at or beyond
+    //! the wheel size are ignored.
+    //
+    void SetPins(uint64_t pins);
+
+
     //! Randomize pin settings.
     //
     //! Randomize such that 40%-60% are active and no
     //! more than six consecutive pins have the same setting.
+    //! Every such setting is equally likely.
     //
     void Randomize(void);
 
@@ -0,0 +1,108 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file LetterReader.cc
+ * \brief Implementation of LetterReader class member functions.
+ * \package hagelin
+ */
+
+#include <cctype>
+
+#include "LetterReader.h"
+
+LetterReader::LetterReader(istream& in, char space, const LineFilter& filter)
+: In(in), Space(space), Filter(filter), Filtering(bool(filter)),
+  Done(false), BlockPos(0), BlockLen(0) {}
+
+void LetterReader::Add(string& text, char c) const {
+  if (Space && c == ' ')
+    c = Space;
+  if (isalpha(static_cast<unsigned char>(c)))
+    text.push_back(c);
+}
+
+void LetterReader::EndLine(string& text) {
+  if (Filtering) {
+    if (Filter(Line)) {
+      // Only the first line found is discarded
+      Filter = LineFilter();
+    } else {
+      for (char c : Line)
+        Add(text, c);
+    }
+    Line.clear();
+  }
+  Filtering = bool(Filter);
+}
+
+bool LetterReader::Fill(string& text, size_t length) {
+  while (text.size() < length) {
+    if (BlockPos == BlockLen) {
+      if (Done)
+        return false;
+      In.read(Block, sizeof(Block));
+      BlockLen = static_cast<size_t>(In.gcount());
+      BlockPos = 0;
+      if (BlockLen == 0) {
+        // The last line needn't end with a newline
+        EndLine(text);
+        Done = true;
+      }
+      continue;
+    }
+    char c = Block[BlockPos++];
+    if (c == '\n') {
+      EndLine(text);
+      continue;
+    }
+    c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    if (Filtering) {
+      Line.push_back(c);
+      if (Line.size() > MAX_FILTER_LINE) {
+        Filtering = false;
+        for (char l : Line)
+          Add(text, l);
+        Line.clear();
+      }
+    } else {
+      Add(text, c);
+    }
+  }
+  return true;
+}
+
+
+bool ReadMessage(istream& in, string& message, const string& separator) {
+  message.clear();
+  string line;
+  bool found = false;
+  while (getline(in, line)) {
+    found = true;
+    size_t end = line.find_last_not_of(" \t\r");
+    size_t begin = line.find_first_not_of(" \t");
+    if (end != string::npos
+        && line.compare(begin, end - begin + 1, separator) == 0)
+      return true;
+    message += line;
+    message += '\n';
+  }
+  return found;
+}
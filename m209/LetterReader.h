@@ -0,0 +1,107 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file LetterReader.h
+ * \brief Definition of the LetterReader class and of ReadMessage.
+ * \package hagelin
+ */
+
+#ifndef _LETTERREADER_H_
+#define _LETTERREADER_H_
+
+#include <string>
+using std::string;
+#include <iostream>
+using std::istream;
+#include <functional>
+
+
+/*!
+ * \brief Reads the letters of a message from a stream a block at a time.
+ *
+ * Letters are upcased and everything else is dropped, except that spaces
+ * may be translated to a letter when enciphering. A filter may be given
+ * to discard the first whole line it accepts, such as the net indicator
+ * line of a ciphertext. Memory use doesn't depend on the size of the
+ * input.
+ */
+class LetterReader {
+
+public:
+
+    //! Returns true if the upcased line is to be discarded.
+    //
+    typedef std::function<bool(const string&)> LineFilter;
+
+    //! Number of letters CipherStream enciphers at a time.
+    //
+    static const size_t CHUNK = 1 << 16;
+
+    //! Lines longer than this are never passed to the filter.
+    //
+    static const size_t MAX_FILTER_LINE = 1024;
+
+    //! Read from in. Spaces become Space unless it is 0. filter may be
+    //! empty.
+    //
+    LetterReader(istream& in, char Space, const LineFilter& filter);
+
+    //! Append letters to text until it holds at least length letters.
+
+    //! Returns false if the input ended first.
+    //
+    bool Fill(string& text, size_t length);
+
+private:
+
+    //! Append c to text if it's a letter.
+    //
+    void Add(string& text, char c) const;
+
+    //! Handle the end of a line.
+    //
+    void EndLine(string& text);
+
+    istream&    In;
+    char        Space;
+    LineFilter  Filter;         //!< empty once a line has been discarded
+    bool        Filtering;      //!< the current line may still be discarded
+    string      Line;           //!< current line, while Filtering
+    bool        Done;           //!< end of input reached
+    char        Block[4096];    //!< input not yet examined
+    size_t      BlockPos;
+    size_t      BlockLen;
+};
+
+
+//! Line separating the messages of a batch.
+//
+#define BATCH_SEPARATOR "%%"
+
+//! Read the next message of a batch from in into message.
+
+//! Messages are separated by lines holding only separator. Returns false,
+//! with message empty, if the input has no more messages.
+//
+bool ReadMessage(istream& in, string& message,
+                 const string& separator = BATCH_SEPARATOR);
+
+#endif // _LETTERREADER_H_
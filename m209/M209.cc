@@ -25,7 +25,6 @@
  */
 
 #include <iostream>
-using std::cerr;
 using std::endl;
 #include <iomanip>
 using std::setw;
@@ -33,17 +32,25 @@ using std::setfill;
 #include <fstream>
 using std::ifstream;
 
+#include <algorithm>
 #include <regex>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include "config.h"
 #include "M209.h"
+#include "CipherKernel.h"
+#include "LetterReader.h"
 #include "KeyListDataBase.hpp"
 
+constexpr int M209::NUM_WHEELS;
+constexpr int M209::NUM_LUG_BARS;
+constexpr const char* M209::KEYFILE_SUFFIX_BIN;
+constexpr const char* M209::KEYDB_SUFFIX;
+
 //! Array of position names for each of the six key wheels.
 //
-static const char *pnames[NUM_WHEELS][27] = {
+static const char *pnames[M209::NUM_WHEELS][27] = {
   
   {"A", "B", "C", "D", "E", "F", "G", "H", "I", "J",
     "K", "L", "M", "N", "O", "P", "Q", "R", "S", "T",
@@ -75,96 +82,151 @@ static const char *pnames[NUM_WHEELS][27] = {
 static const int offsets[] = {-11, -11, -10, -9, -8, -7};
 
 
+//! The six wheel types made from pnames and offsets, built on first use
+//! and shared by every M209.
+//
+static const vector<WheelType>& WheelTypes() {
+  static const vector<WheelType> types = [] {
+    vector<WheelType> t;
+    for (int i = 0; i < M209::NUM_WHEELS; i++) {
+      vector<string> names;
+      for (int j = 0; pnames[i][j]; j++) {
+        names.push_back(pnames[i][j]);
+      }
+      t.emplace_back(names, offsets[i]);
+    }
+    return t;
+  }();
+  return types;
+}
+
+
 M209::M209() {
   int    i;
   
 //  Drum.resize(NUM_LUG_BARS);
   
+  SearchJobs = 1;
   Wheels.resize(NUM_WHEELS);
   for (i = 0; i < NUM_WHEELS; i++) {
-    for (int j = 0; pnames[i][j]; j++) {
-      Wheels[i].AddPosition(pnames[i][j]);
-    }
-    Wheels[i].SetReadOffset(offsets[i]);
+    Wheels[i].SetType(WheelTypes()[i]);
   }
   
   ClearKey();
 }
 
 
-char M209::Cipher(char c) {
-  int      cnum, i, j, key;
+void M209::BuildKeyTable(void) {
+  Engine::BuildKeyTable(Drum, KeyTable);
+}
+
+
+unsigned M209::ReadPins(void) const {
+  unsigned mask = 0;
+  for (int i=0; i<NUM_WHEELS; i++) {
+    mask |= unsigned(Wheels[i].ReadPinOffset()) << i;
+  }
+  return mask;
+}
+
+
+template<class Tracer>
+char M209::CipherLetter(char c, Tracer& trace) {
+  int      key;
   char           c2;
-  bool    match;
-  vector <bool>  pins;
+  unsigned pins;
   
   // Check for valid character
   if ((c < 'A') || (c > 'Z')) {
     throw std::invalid_argument("M209::Cipher(): invalid character");
   }
   
-  // Get character number, 0..25
-  cnum = c - 'A';
-  
   // Get mask of active pins at offsets from current code wheel positions.
-  pins.resize(NUM_WHEELS);
-  for (i=0; i<NUM_WHEELS; i++) {
-    pins[i] = Wheels[i].ReadPinOffset();
-  }
+  pins = ReadPins();
   
-  // Compare active pins to each lug bar. For each bar where one or
-  // more active lugs match an active pin, add one to the key value.
-  for (i=0, key=0; i<NUM_LUG_BARS; i++) {
-    for (j=0, match=0; j<NUM_WHEELS; j++) {
-      if (Drum[i][j] & pins[j]) {
-        match = true;
-      }
-    }
-    if (match) {
-      ++key;
-    }
-  }
+  // Each lug bar with one or more active lugs matching an active pin
+  // adds one to the key value. KeyTable holds the count for every mask.
+  key = KeyTable[pins].key;
   
-  // Subtract calculated key (0-27) from input character, modulo 26
-  cnum -= key;
-  while (cnum < 0) {
-    cnum += 26;
-  }
-  cnum = cnum % 26;
+  // Subtract calculated key (0-27) from input character, modulo 26, and
+  // take the ciphered letter from the reciprocal alphabet
+  c2 = Engine::Cipher(c, key, 0);
   
   // Increment the letter counter
   ++LetterCounter;
   
-  // Compute ciphered letter from reciprocal alphabet
-  c2 = 'Z' - cnum;
+  trace.Letter(LetterCounter, pins, c, key, c2);
+  
+  // Advance each code wheel.
+  for (int i=0; i<NUM_WHEELS; i++) {
+    Wheels[i].Step();
+  }
+  
+  return c2;
+}
+
+
+char M209::Cipher(char c) {
+  if (Ctx.Verbose) {
+    LetterTrace trace(Wheels, *Ctx.Log, 1);
+    return CipherLetter(c, trace);
+  }
+  NoTrace trace;
+  return CipherLetter(c, trace);
+}
+
+
+
+vector<unsigned char> M209::Keystream(const array<int, NUM_WHEELS>& StartPositions,
+                                      size_t length) const {
+  Engine::WheelState state;
+  vector<unsigned char> key(length);
   
-  if (Verbose) {
-    cerr << "Counter: "
-    << setfill('0') << setw(4) << dec << LetterCounter
-    << "  Wheels: ";
-    for (i=0; i<NUM_WHEELS; i++) {
-      cerr << Wheels[i].GetPosName();
+  state.Load(Wheels);
+  for (int i=0; i<NUM_WHEELS; i++) {
+    if ((StartPositions[i] < 0) ||
+        (StartPositions[i] >= Wheels[i].GetWheelSize())) {
+      throw std::invalid_argument("M209::Keystream(): position out of bounds");
     }
-    cerr << "  Pin Positions: ";
-    for (i=0; i<NUM_WHEELS; i++) {
-      cerr << Wheels[i].GetOffsetName();
+    state.read[i] = Wheels[i].ReadPosAt(StartPositions[i]);
+  }
+  if (length > 0) {
+    Engine::Keystream(KeyTable, state, length, &key[0]);
+  }
+  return key;
+}
+
+
+void M209::CipherBuffer(const char* in, size_t length, char* out) {
+  const size_t  chunk = 4096;       // letters per keystream block
+  unsigned char key[chunk];
+  Engine::WheelState state;
+  
+  for (size_t n=0; n<length; n++) {
+    if ((in[n] < 'A') || (in[n] > 'Z')) {
+      throw std::invalid_argument("M209::CipherBuffer(): invalid character");
     }
-    cerr << "  Pin Values: ";
-    for (i=0; i<NUM_WHEELS; i++) {
-      cerr << pins[i];
+  }
+  
+  if (Ctx.Verbose) {
+    // Take the slow path so that every letter is traced.
+    LetterTrace trace(Wheels, *Ctx.Log);
+    for (size_t n=0; n<length; n++) {
+      out[n] = CipherLetter(in[n], trace);
     }
-    cerr << "  In: " << c
-    << "  Key: " << setfill(' ') << setw(2) << key
-    << "  Out: " << c2;
-    cerr << endl;
+    return;
   }
   
-  // Advance each code wheel.
-  for (i=0; i<NUM_WHEELS; i++) {
-    Wheels[i].Rotate(1);
+  state.Load(Wheels);
+  for (size_t start=0; start<length; start += chunk) {
+    size_t  len = std::min(chunk, length-start);
+    Engine::Keystream(KeyTable, state, len, key);
+    Engine::Apply(in+start, key, len, 0, out+start);
   }
   
-  return c2;
+  // Advance each code wheel past the letters just processed.
+  state.Store(Wheels);
+  LetterCounter += length;
 }
 
 
@@ -178,6 +240,7 @@ void M209::ClearKey(void) {
       Drum[i][j] = false;
     }
   }
+  BuildKeyTable();
   LetterCounter = 0;
 }
 
@@ -205,7 +268,7 @@ void M209::PrintKey(string KeyListIndicator, string NetIndicator,
   for (i = 0; i < NUM_LUG_BARS; i++) {
     os << setfill('0') << setw(2) << (i+1);
     
-    bitset2lugs(Drum[i], c1, c2);
+    Engine::BarLugs(Drum[i], c1, c2);
     // by popular demand
 	if (c1 == '0' && (c2 == '1' || c2 == '2'))
 		swap(c1, c2);
@@ -263,9 +326,8 @@ bool M209::LoadKey(date d, string& KeyListIndicator, string& NetIndicator) {
   if (getenv("M209_KEYLIST_DIR") != nullptr)
     root_dir = getenv("M209_KEYLIST_DIR");
   else {
-    cerr << "ERROR: Environmental variable M209_KEYLIST_DIR must be defined to";
-    cerr << " use the -A mode." << endl;
-    exit(1);
+    throw std::runtime_error("Environmental variable M209_KEYLIST_DIR must be defined"
+                             " to use the -A mode.");
   }
   if (root_dir.back() != '/')
     root_dir += "/";
@@ -274,10 +336,42 @@ bool M209::LoadKey(date d, string& KeyListIndicator, string& NetIndicator) {
   string m_str = d_str.substr(5,3);
   boost::to_upper(m_str);
   KeyListIndicator = Date2KeyListIndicator(NetIndicator, d);
-  string key_file = NetIndicator + "-" + y_str + "/" + m_str + "/keys/" + KeyListIndicator + ".txt";
-  bool ret = LoadKey(root_dir + key_file);
-  if (!ret) {
-    cerr << "Could not load key from file " << (root_dir + key_file) << endl;
+  KeyCache<KeyState>::Key key{KeyRecord::M209, root_dir, NetIndicator,
+                              d.day_number()};
+  KeyState state;
+  if (KeyListCache.Lookup(key, state)) {
+    if (Ctx.Verbose) {
+      *Ctx.Log << "Using cached key for " << NetIndicator << " " << d << endl;
+    }
+    Wheels = state.wheels;
+    Drum = state.drum;
+    KeyTable = state.key_table;
+    LetterCounter = 0;
+    return true;
+  }
+  bool ret;
+  string db_file = root_dir + NetIndicator + KEYDB_SUFFIX;
+  if (ifstream(db_file)) {
+    if (!Ctx.Quiet) {
+      *Ctx.Log << "Loading key from data base " << db_file << endl;
+    }
+    KeyDataBase db(db_file);
+    const KeyRecord* record = db.Find(d.day_number());
+    ret = record != nullptr;
+    if (ret) {
+      SetKeyRecord(*record);
+    } else {
+      *Ctx.Log << "No key for " << d << " in " << db_file << endl;
+    }
+  } else {
+    string key_file = NetIndicator + "-" + y_str + "/" + m_str + "/keys/" + KeyListIndicator + ".txt";
+    ret = LoadKey(root_dir + key_file);
+    if (!ret) {
+      *Ctx.Log << "Could not load key from file " << (root_dir + key_file) << endl;
+    }
+  }
+  if (ret) {
+    KeyListCache.Insert(key, KeyState{Wheels, Drum, KeyTable});
   }
   return ret;
 }
@@ -285,13 +379,16 @@ bool M209::LoadKey(date d, string& KeyListIndicator, string& NetIndicator) {
 
 bool M209::LoadKey(const string& fname, string& KeyListIndicator, string &NetIndicator) {
 
-  if (Verbose) {
-    cerr << "Looking for key file " << fname << endl;
+  if (boost::algorithm::ends_with(fname, KEYFILE_SUFFIX_BIN)) {
+    return LoadBinaryKey(fname, KeyListIndicator, NetIndicator);
+  }
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Looking for key file " << fname << endl;
   }
   ifstream keyfile(fname, ifstream::in); // key file input stream
   if (!keyfile) return false;
-  if (!Quiet) {
-    cerr << "Loading key file " << fname << endl;
+  if (!Ctx.Quiet) {
+    *Ctx.Log << "Loading key file " << fname << endl;
   }
   LoadKey(keyfile, KeyListIndicator, NetIndicator);
   return true;
@@ -352,8 +449,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
   }
   this->ClearKey();
   
-  if (Verbose) {
-    cerr << "Reading key file " << endl;
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Reading key file " << endl;
   }
   
   // Read key file one line at a time
@@ -362,8 +459,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
     if (std::regex_match(line, matches, key_regex)) {
       // Found a pin/lug setting line
       
-      if (Verbose) {
-        cerr << "  pin/lug line \"" << line << "\"";
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  pin/lug line \"" << line << "\"";
       }
       
       // sanity check
@@ -374,8 +471,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
       
       // decode lugbar number
       int lugbar_num = boost::lexical_cast<int>(matches[1].str()) - 1;
-      if (Verbose) {
-        cerr << "  lugbar " << (lugbar_num + 1);
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  lugbar " << (lugbar_num + 1);
       }
       if ((lugbar_num < 0) || (lugbar_num >= NUM_LUG_BARS)) {
         throw std::range_error("M209::LoadKey(): Key file error:"
@@ -392,8 +489,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
       // decode and sanity-check lug settings
       int lug1 = boost::lexical_cast<int>(matches[2].str());
       int lug2 = boost::lexical_cast<int>(matches[3].str());
-      if (Verbose) {
-        cerr << "  lugs " << lug1 << " " << lug2;
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  lugs " << lug1 << " " << lug2;
       }
       if ((lug1 < 0) || (lug1 > 6) || (lug2 < 0) || (lug2  >6)) {
         throw std::range_error("M209::LoadKey(): Key file error:"
@@ -435,8 +532,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
       
       
       // Set pins
-      if (Verbose) {
-        cerr << "  pins ";
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  pins ";
       }
       for (int n=0; n < expected_pins; n++) {
         if (pins[n] != '-') {
@@ -446,25 +543,25 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
                                    " Incorrect pin position letter.");
           }
           Wheels[n].SetPin(1);
-          if (Verbose) {
-            cerr << "+";
+          if (Ctx.Verbose) {
+            *Ctx.Log << "+";
           }
         } else {
-          if (Verbose) {
-            cerr << "-";
+          if (Ctx.Verbose) {
+            *Ctx.Log << "-";
           }
         }
       }
-      if (Verbose) {
-        cerr << endl;
+      if (Ctx.Verbose) {
+        *Ctx.Log << endl;
       }
       
       
     } else if (std::regex_match(line, matches, check_regex)) {
       // Found the 26 letter check line
       
-      if (Verbose) {
-        cerr << "  letter check line \"" << line << "\"" << endl;
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  letter check line \"" << line << "\"" << endl;
       }
       
       // sanity check
@@ -494,8 +591,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
       
     } else if (std::regex_match(line, matches, netind_regex)) {
       // Found a net indicator
-      if (Verbose) {
-        cerr << "  net indicator line \"" << line << "\"" << endl;
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  net indicator line \"" << line << "\"" << endl;
       }
       
       NetIndicator.assign(matches[1].str());
@@ -503,16 +600,16 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
       
     } else if (std::regex_match(line, matches, keyind_regex)) {
       // Found a key list indicator
-      if (Verbose) {
-        cerr << "  key list indicator line \"" << line << "\"" << endl;
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  key list indicator line \"" << line << "\"" << endl;
       }
       
       KeyListIndicator.assign(matches[3].str());
       
       
     } else {
-      if (Verbose) {
-        cerr << "  discarding line \"" << line << "\"" << endl;
+      if (Ctx.Verbose) {
+        *Ctx.Log << "  discarding line \"" << line << "\"" << endl;
       }
     }
     
@@ -526,10 +623,12 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
     }
   }
   
+  BuildKeyTable();
+  
   // If we found a 26 letter check line, then verify the key settings.
   if (found_check) {
-    if (Verbose) {
-      cerr << "Running 26 letter check" << endl;
+    if (Ctx.Verbose) {
+      *Ctx.Log << "Running 26 letter check" << endl;
     }
     
     string test_line;
@@ -544,8 +643,8 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
                              " 26 letter check failed.");
     }
   } else {
-    if (Verbose) {
-      cerr << "Skipping 26 letter check" << endl;
+    if (Ctx.Verbose) {
+      *Ctx.Log << "Skipping 26 letter check" << endl;
     }
   }
   
@@ -557,49 +656,113 @@ void M209::LoadKey(istream& keyfile, string& KeyListIndicator, string& NetIndica
 }
 
 
+KeyRecord M209::GetKeyRecord(const string& KeyListIndicator,
+                             const string& NetIndicator) const {
+  KeyRecord record = KeyRecord();
+  
+  record.machine = KeyRecord::M209;
+  record.bars = NUM_LUG_BARS;
+  record.SetNetIndicator(NetIndicator);
+  if (KeyListIndicator.length() == 2) {
+    record.kli[0] = KeyListIndicator[0];
+    record.kli[1] = KeyListIndicator[1];
+  }
+  for (int i=0; i<NUM_WHEELS; i++) {
+    record.wheel_idx[i] = i;
+    record.pins[i] = Wheels[i].GetPins();
+  }
+  for (int i=0; i<NUM_LUG_BARS; i++) {
+    record.lugs[i] = Drum[i].to_ulong();
+  }
+  return record;
+}
+
+
+void M209::SetKeyRecord(const KeyRecord& record) {
+  if (record.machine != KeyRecord::M209 || record.bars != NUM_LUG_BARS) {
+    throw std::invalid_argument("M209::SetKeyRecord(): not an M209 key");
+  }
+  for (int i=0; i<NUM_LUG_BARS; i++) {
+    bitset<NUM_WHEELS> bar(record.lugs[i]);
+    if (record.lugs[i] >> NUM_WHEELS || bar.count() > 2) {
+      throw std::invalid_argument("M209::SetKeyRecord(): bad lug bar");
+    }
+    Drum[i] = bar;
+  }
+  for (int i=0; i<NUM_WHEELS; i++) {
+    Wheels[i].SetPins(record.pins[i]);
+    Wheels[i].SetPosition(0);
+  }
+  BuildKeyTable();
+  LetterCounter = 0;
+}
+
+
+bool M209::LoadBinaryKey(const string& fname, string& KeyListIndicator,
+                         string& NetIndicator) {
+  if (Ctx.Verbose) {
+    *Ctx.Log << "Looking for key file " << fname << endl;
+  }
+  if (!ifstream(fname)) return false;
+  if (!Ctx.Quiet) {
+    *Ctx.Log << "Loading key file " << fname << endl;
+  }
+  KeyFile keyfile(fname);
+  const KeyRecord& record = keyfile.Record();
+  SetKeyRecord(record);
+  if (record.net[0] != 0) {
+    NetIndicator = record.NetIndicator();
+  }
+  if (record.kli[0] != 0) {
+    KeyListIndicator.assign(record.kli, 2);
+  }
+  return true;
+}
+
+
+bool M209::SaveBinaryKey(const string& fname, const string& KeyListIndicator,
+                         const string& NetIndicator) const {
+  return KeyFile::Write(fname, GetKeyRecord(KeyListIndicator, NetIndicator));
+}
+
+
 void M209::ResetCounter(void) {
   int   i;
   
   for (i = 0; i<NUM_WHEELS; i++) {
-    Wheels[i].Rotate(-LetterCounter);
+    Wheels[i].Rotate(-int(LetterCounter % Wheels[i].GetWheelSize()));
   }
   
   LetterCounter = 0;
 }
 
 
-bool M209::SetWheels(vector<string> indicator) {
-  int    i, j;
-  
-  
-  for (i=0, j=0; (i<NUM_WHEELS) && (j < (int)indicator.size()); i++, j++) {
-    try {
-      if (Verbose) {
-        cerr << "Trying wheel "
-        << dec << i
-        << " setting "
-        << indicator[j]
-        << endl;
-      }
-      Wheels[i].SetPosByName(indicator[j]);
-    } catch (...) {
-      // reset counters to force retry with next indicator value
-      --i;
-    }
+const uint64_t M209::CYCLE;
+
+void M209::Seek(uint64_t letterIndex) {
+  for (int i=0; i<NUM_WHEELS; i++) {
+    int  size = Wheels[i].GetWheelSize();
+    Wheels[i].Rotate(int(letterIndex % size) - int(LetterCounter % size));
   }
   
-  if (i < NUM_WHEELS) {
-    // Unable to set wheels as requested
+  LetterCounter = letterIndex;
+}
+
+
+bool M209::SetWheels(const vector<string>& indicator) {
+  if (!Engine::SetPositions(Wheels, indicator, Ctx)) {
     return false;
   }
-  
-  if (Verbose) {
-    cerr << "Wheels set to: ";
-    for (i=0; i<NUM_WHEELS; i++) {
-      cerr << Wheels[i].GetPosName();
-    }
-    cerr << endl;
+  LetterCounter = 0;
+  return true;
+}
+
+
+bool M209::TrySetPositions(const char* const* names, size_t count) {
+  if (!Engine::TrySetPositions(Wheels, names, count, Ctx)) {
+    return false;
   }
+  LetterCounter = 0;
   return true;
 }
 
@@ -612,28 +775,33 @@ void M209::CipherStream(bool AutoKey,
                         string& NetIndicator,
                         string KeyDir,
                         bool CipherMode,
-                        istream& InText, ostream& OutText) {
+                        istream& InText, ostream& OutText,
+                        bool Streaming) {
   
   int      i;
   int      r;
   int      tries;
   char    MsgIndLtr='A';  // Letter enciphered to get IntMsgInd
-  char    InC, OutC;  // Input and Output characters
+  char    OutC;    // Output character
   vector<string>  ExtMsgInd;  // External Message Indicator
   vector<string>  IntMsgInd;  // Internal Message Indicator
-  list<char>    MsgText;  // Text of input message
+  const char*  ExtMsgNames[6];   // ExtMsgInd and IntMsgInd as names
+  const char*  IntMsgNames[12];  // for TrySetPositions
+  string    MsgText;  // Letters read but not yet processed
+  size_t    MsgBegin; // Start of the part of MsgText still to be processed
+  string    CipherText;  // MsgText after encipherment/decipherment
   vector<char>  MsgInd1, MsgInd2;
   string    MyKLI;    // Key list indicator
   stringstream  OutBuf;    // Output buffer
-  string    line;    // Line buffer for input stream
   std::regex  netind_regex;  // regex matching net indicator line of message
   std::smatch       matches;        // matches returned by regex_match
-  bool    FoundNetInd = false;
   
   
   // Output is buffered in OutBuf so that we can insert group count at
   // beginning of buffer after generating ciphertext if needed. This is
-  // a bit of a kludge, but it works.
+  // a bit of a kludge, but it works. In streaming mode the output goes
+  // straight to OutText and the group count is left out.
+  ostream&  Out = Streaming ? OutText : OutBuf;
   
   
   // Prepare message indicator vectors
@@ -662,58 +830,35 @@ void M209::CipherStream(bool AutoKey,
   "([0-9]+)"         // group count
   "[\\s]*";         // optional trailing whitespace
   
-  // Read entire input message into buffer. If we are deciphering
-  // with automatic indicator extraction, we will look for repeated
-  // message indicators at end of message, and snip them off.
-  while (InText.good()) {
-    // Read a line
-    getline(InText, line);
-    
-    // upcase it
-    boost::to_upper(line);
-    
-    if (Verbose) {
-      cerr << "read message line \"" << line << "\"" << endl;
-    }
-    
-    // If decipher mode, discard it if it looks like
-    // a net indicator line. Only discard the first such
-    // line found.
-    if (!CipherMode && !FoundNetInd) {
-      if (std::regex_match(line, matches, netind_regex)) {
-        // Line looks like a net indicator line.
-        if (AutoKey) {
-          NetIndicator = matches[1].str();
-          if (Verbose) {
-            cerr << "Using NetIndicator \"" << NetIndicator << "\" from cipher text" << endl;
-          }
-        } else {
-          if (Verbose) {
-            cerr << "Discarding net indicator line \"" << line << "\"" << endl;
-          }
+  // Read the input a chunk at a time. If we are deciphering with
+  // automatic indicator extraction, the repeated message indicator at
+  // the end of the message is held back in MsgText until the input ends.
+  // If decipher mode, discard the first line that looks like a net
+  // indicator line.
+  LetterReader::LineFilter NetIndFilter;
+  if (!CipherMode) {
+    NetIndFilter = [&](const string& line) {
+      if (!std::regex_match(line, matches, netind_regex))
+        return false;
+      // Line looks like a net indicator line.
+      if (AutoKey) {
+        NetIndicator = matches[1].str();
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Using NetIndicator \"" << NetIndicator << "\" from cipher text" << endl;
+        }
+      } else {
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Discarding net indicator line \"" << line << "\"" << endl;
         }
-        FoundNetInd = true;
-        continue;
-      }
-    }
-    
-    // Now copy the line into the message buffer, processing
-    // it char by char
-    for (string::iterator i=line.begin(); i < line.end(); i++) {
-      InC = *i;
-      
-      // When enciphering, translate space to Z
-      if (CipherMode && (InC == ' ')) {
-        InC = 'Z';
-      }
-      
-      // Ignore if not alphabetic
-      if (isalpha(InC)) {
-        MsgText.push_back(InC);
       }
-      
-    }
+      return true;
+    };
   }
+  // When enciphering, translate space to Z
+  LetterReader Reader(InText, CipherMode ? 'Z' : 0, NetIndFilter);
+  const size_t Hold = (AutoMsgIndicator && !CipherMode) ? MsgInd2.size() : 0;
+  bool More = Reader.Fill(MsgText, LetterReader::CHUNK + Hold);
+  MsgBegin = 0;
   
   // Are we automatically setting message indicators?
   if (AutoMsgIndicator) {
@@ -722,7 +867,7 @@ void M209::CipherStream(bool AutoKey,
       // Must generate random indicator, encipher it, and include it
       // in the ciphertext. If 2-char key list indicator passed in,
       // use it, and also look for a keylist file named
-      // {keylist indicator}.txt or {keylist indicator}.m209key.
+      // {keylist indicator}.m209bin, .txt or .m209key.
       // If not passed in, then
       // repeat system indicator in place of key list indicator.
       
@@ -730,8 +875,7 @@ void M209::CipherStream(bool AutoKey,
       if (AutoKey) {
         date now = day_clock::universal_day();
         if (!LoadKey(now, KeyListIndicator, NetIndicator)) {
-          cerr << "ERROR: Unable to load key data base " << endl;
-          exit(1);
+          throw std::runtime_error("Unable to load key data base");
           
         }
         MyKLI = KeyListIndicator;
@@ -739,14 +883,15 @@ void M209::CipherStream(bool AutoKey,
       } else {
         MyKLI = KeyListIndicator;
         
+        string Keyfile0 = KeyDir + "/" + MyKLI + KEYFILE_SUFFIX_BIN;
         string Keyfile1 = KeyDir + "/" + MyKLI + KEYFILE_SUFFIX1;
         string Keyfile2 = KeyDir + "/" + MyKLI + KEYFILE_SUFFIX2;
 
-        if (LoadKey(Keyfile1, KeyListIndicator, NetIndicator)) {
+        if (LoadKey(Keyfile0, KeyListIndicator, NetIndicator)) {
+        } else if (LoadKey(Keyfile1, KeyListIndicator, NetIndicator)) {
         } else if (LoadKey(Keyfile2, KeyListIndicator, NetIndicator)) {
-        } else if (!Quiet) {
-          cerr << "ERROR: Key file not found." << endl;
-          exit(1);
+        } else if (!Ctx.Quiet) {
+          throw std::runtime_error("Key file not found.");
         }
       }
 
@@ -755,9 +900,8 @@ void M209::CipherStream(bool AutoKey,
       do {
         // Avoid infinite loop
         if (tries++ >= 100) {
-          cerr << "ERROR: Cannot generate message indicator!"
-          << " Is random() broken?" << endl;
-          exit(1);
+          throw std::runtime_error("Cannot generate message indicator!"
+                                   " Is random() broken?");
         }
         
         // Clear letter counter and randomize wheel positions.
@@ -780,21 +924,25 @@ void M209::CipherStream(bool AutoKey,
           IntMsgInd[i]=Cipher(MsgIndLtr);
         }
         
-        if (Verbose) {
-          cerr << "Try "
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Try "
           << dec << tries
           << " EMI=";
           for (i=0; i<(int)ExtMsgInd.size(); i++) {
-            cerr << ExtMsgInd[i];
+            *Ctx.Log << ExtMsgInd[i];
           }
-          cerr << " letter=" << MsgIndLtr << " IMI=";
+          *Ctx.Log << " letter=" << MsgIndLtr << " IMI=";
           for (i=0; i<(int)IntMsgInd.size(); i++) {
-            cerr << IntMsgInd[i];
+            *Ctx.Log << IntMsgInd[i];
           }
-          cerr << endl;
+          *Ctx.Log << endl;
         }
         
-      } while (!SetWheels(IntMsgInd));
+        
+        for (i=0; i<(int)IntMsgInd.size(); i++) {
+          IntMsgNames[i] = IntMsgInd[i].c_str();
+        }
+      } while (!TrySetPositions(IntMsgNames, IntMsgInd.size()));
       
       if (KeyListIndicator.length() != 2) {
         MyKLI.clear();
@@ -808,14 +956,14 @@ void M209::CipherStream(bool AutoKey,
       
       // Print system indicator, external message indicator
       // and key list indicator
-      OutBuf << MsgIndLtr << MsgIndLtr;
+      Out << MsgIndLtr << MsgIndLtr;
       for (i=0; i<(int)ExtMsgInd.size(); i++) {
-        OutBuf << ExtMsgInd[i];
+        Out << ExtMsgInd[i];
         if (((i+3) % 5) == 0) {
-          OutBuf << ' ';
+          Out << ' ';
         }
       }
-      OutBuf << KeyListIndicator << ' ';
+      Out << KeyListIndicator << ' ';
       
       
       
@@ -825,40 +973,23 @@ void M209::CipherStream(bool AutoKey,
       // First, check for valid message indicator at each
       // end of message.
       
-      if (MsgText.size() < 25) {
+      if (!More && MsgText.size() < 25) {
         // Message is too small for message indicators
         // plus at least one 5-letter group.
-        cerr << "ERROR: Message is too small."
-        << endl;
-        exit(1);
+        throw std::runtime_error("Message is too small.");
       }
       for (i=0; i<(int)MsgInd1.size(); i++) {
-        MsgInd1[i] = MsgText.front();
-        MsgInd2[MsgInd2.size()-(i+1)] = MsgText.back();
-        MsgText.pop_front();
-        MsgText.pop_back();
+        MsgInd1[i] = MsgText[MsgBegin++];
       }
-      if (Verbose) {
-        cerr << "MsgInd1 = \"";
+      if (Ctx.Verbose) {
+        *Ctx.Log << "MsgInd1 = \"";
         for (i=0; i<(int)MsgInd1.size(); i++) {
-          cerr << MsgInd1[i];
-        }
-        cerr << "\"" << endl;
-        cerr << "MsgInd2 = \"";
-        for (i=0; i<(int)MsgInd2.size(); i++) {
-          cerr << MsgInd2[i];
-        }
-        cerr << "\"" << endl;
-      }
-      if (MsgInd1 != MsgInd2) {
-        if (!Quiet) {
-          cerr << "WARNING: Duplicate message indicator does not match." << endl;
+          *Ctx.Log << MsgInd1[i];
         }
+        *Ctx.Log << "\"" << endl;
       }
       if (MsgInd1[0] != MsgInd1[1]) {
-        cerr << "ERROR: System indicator not found."
-        << endl;
-        exit(1);
+        throw std::runtime_error("System indicator not found.");
       }
       
       // Extract message indicator components
@@ -873,30 +1004,32 @@ void M209::CipherStream(bool AutoKey,
       if (AutoKey) {
         date d = KeyListIndicator2Date(NetIndicator, MyKLI);
         if (!LoadKey(d, KeyListIndicator, NetIndicator)) {
-          cerr << "ERROR: Unable to load key from data base" << endl;
-          exit(1);
+          throw std::runtime_error("Unable to load key from data base");
         }
       } else {
         // See if corresponding key file exists
-        // Try .txt extension first, then .m209key if not found.
+        // Try the binary key first, then .txt and .m209key.
+        string Keyfile0 = KeyDir + "/" + MyKLI + KEYFILE_SUFFIX_BIN;
         string Keyfile1 = KeyDir + "/" + MyKLI + KEYFILE_SUFFIX1;
         string Keyfile2 = KeyDir + "/" + MyKLI + KEYFILE_SUFFIX2;
 
-        if (LoadKey(Keyfile1)) {
+        if (LoadKey(Keyfile0)) {
+        } else if (LoadKey(Keyfile1)) {
         } else if (LoadKey(Keyfile2)) {
         } else {
-          cerr << "ERROR: Key file not found." << endl;
-          exit(1);
+          throw std::runtime_error("Key file not found.");
         }
 
       }
       
       // Generate internal message indicator
       LetterCounter = 0;
-      if (!SetWheels(ExtMsgInd)) {
-        cerr << "ERROR: Could not set wheels to external message indicator."
-        << endl;
-        exit(1);
+      for (i=0; i<(int)ExtMsgInd.size(); i++) {
+        ExtMsgNames[i] = ExtMsgInd[i].c_str();
+      }
+      if (!TrySetPositions(ExtMsgNames, ExtMsgInd.size())) {
+        throw std::runtime_error("Could not set wheels to external message"
+                                 " indicator.");
       }
       for (i=0; i<(int)IntMsgInd.size(); i++) {
         IntMsgInd[i]=Cipher(MsgIndLtr);
@@ -904,38 +1037,76 @@ void M209::CipherStream(bool AutoKey,
       
       // Reset letter counter and attempt to set wheels
       LetterCounter = 0;
-      if (!SetWheels(IntMsgInd)) {
-        cerr << "ERROR: Failed to set internal message indicator."
-        << endl;
-        exit(1);
+      for (i=0; i<(int)IntMsgInd.size(); i++) {
+        IntMsgNames[i] = IntMsgInd[i].c_str();
+      }
+      if (!TrySetPositions(IntMsgNames, IntMsgInd.size())) {
+        throw std::runtime_error("Failed to set internal message indicator.");
       }
     }
   } // if AutoMsgIndicator
   
-  while (!MsgText.empty()) {
-    InC = MsgText.front();
-    MsgText.pop_front();
-    
-    // Process the character
-    OutC = Cipher(InC);
-    
-    // In decipher mode, convert Z to space
-    if (!CipherMode && (OutC == 'Z')) {
-      OutC = ' ';
+  // Process the message a chunk at a time, keeping back the last Hold
+  // letters
+  uint64_t Count = LetterCounter;  // letter counter for each output letter
+  string Formatted;
+  for (;;) {
+    size_t length = MsgText.size() - MsgBegin;
+    length = (length > Hold) ? length - Hold : 0;
+    CipherText.resize(length);
+    if (length) {
+      CipherBuffer(&MsgText[MsgBegin], length, &CipherText[0]);
     }
+    MsgText.erase(0, MsgBegin + length);
+    MsgBegin = 0;
     
-    // Output the character
-    OutBuf << OutC;
-    
-    // Add a space or line break every five letters in encipher mode.
-    if (CipherMode && LetterCounter && (LetterCounter % 5 == 0)) {
+    Formatted.clear();
+    for (string::iterator i=CipherText.begin(); i < CipherText.end(); i++) {
+      OutC = *i;
+      ++Count;
       
-      // Break line every 25 letters, also counting the initial 10 letter
-      // message indicator when appropriate.
-      if (((LetterCounter + ((AutoMsgIndicator && CipherMode)?10:0)) % 25) == 0) {
-        OutBuf << endl;
-      } else {
-        OutBuf << ' ';
+      // In decipher mode, convert Z to space
+      if (!CipherMode && (OutC == 'Z')) {
+        OutC = ' ';
+      }
+      
+      // Output the character
+      Formatted.push_back(OutC);
+      
+      // Add a space or line break every five letters in encipher mode.
+      if (CipherMode && Count && (Count % 5 == 0)) {
+        
+        // Break line every 25 letters, also counting the initial 10 letter
+        // message indicator when appropriate.
+        if (((Count + ((AutoMsgIndicator && CipherMode)?10:0)) % 25) == 0) {
+          Formatted.push_back('\n');
+        } else {
+          Formatted.push_back(' ');
+        }
+      }
+    }
+    Out << Formatted;
+    
+    if (!More)
+      break;
+    More = Reader.Fill(MsgText, LetterReader::CHUNK + Hold);
+  }
+  
+  if (Hold) {
+    // What's left is the duplicate message indicator
+    for (i=0; i<(int)MsgInd2.size(); i++) {
+      MsgInd2[i] = MsgText[i];
+    }
+    if (Ctx.Verbose) {
+      *Ctx.Log << "MsgInd2 = \"";
+      for (i=0; i<(int)MsgInd2.size(); i++) {
+        *Ctx.Log << MsgInd2[i];
+      }
+      *Ctx.Log << "\"" << endl;
+    }
+    if (MsgInd1 != MsgInd2) {
+      if (!Ctx.Quiet) {
+        *Ctx.Log << "WARNING: Duplicate message indicator does not match." << endl;
       }
     }
   }
@@ -945,42 +1116,43 @@ void M209::CipherStream(bool AutoKey,
     // Pad out message if necessary with unenciphered 'X's
     if (LetterCounter % 5) {
       while (LetterCounter % 5) {
-        if (Verbose) {
-          cerr << "Padding with unenciphered X" << endl;
+        if (Ctx.Verbose) {
+          *Ctx.Log << "Padding with unenciphered X" << endl;
         }
-        OutBuf << 'X';
+        Out << 'X';
         ++LetterCounter;
       }
       
       if (((LetterCounter + 10) % 25) == 0) {
-        OutBuf << endl;
+        Out << endl;
       } else {
-        OutBuf << ' ';
+        Out << ' ';
       }
     }
     
     
     // Print system indicator, external message indicator
     // and key list indicator
-    OutBuf << MsgIndLtr << MsgIndLtr;
+    Out << MsgIndLtr << MsgIndLtr;
     for (i=0; i<(int)ExtMsgInd.size(); i++) {
-      OutBuf << ExtMsgInd[i];
+      Out << ExtMsgInd[i];
       
       // Add a space or line break every five letters
       if (((i+3) % 5) == 0) {
         if (((LetterCounter + 10 + (i+3)) % 25) == 0) {
-          OutBuf << endl;
+          Out << endl;
         } else {
-          OutBuf << ' ';
+          Out << ' ';
         }
       }
       
     }
-    OutBuf << MyKLI << ' ' << endl;
+    Out << MyKLI << ' ' << endl;
     
     // If NetIndicator is not empty, then add net indicator
-    // and group count at beginning of output buffer.
-    if (!NetIndicator.empty()) {
+    // and group count at beginning of output buffer. In streaming mode
+    // the beginning has already been written.
+    if (!NetIndicator.empty() && !Streaming) {
       string tempbuf  = OutBuf.str();
       OutBuf.clear();
       OutBuf.str(std::string());
@@ -990,7 +1162,10 @@ void M209::CipherStream(bool AutoKey,
     
   }
   
-  OutBuf << endl;
+  Out << endl;
+  
+  if (Streaming)
+    return;
   
   // Finally, send buffered output to output stream.
   OutText << OutBuf.str();
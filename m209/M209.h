@@ -33,20 +33,23 @@ using std::bitset;
 using namespace boost::gregorian;
 
 #include "Keywheel.h"
+#include "DrumCache.h"
+#include "KeyRecord.h"
+#include "KeyCache.h"
+#include "Context.h"
+#include "Trace.h"
+#include "HagelinMachine.h"
 
 #include <iostream>
 #include <vector>
 #include <array>
+#include <cstdint>
+#include <atomic>
+#include <memory>
 
+class DrumCatalog;
 
 
-//! Number of pin wheels.
-//
-#define NUM_WHEELS  6
-
-//! Number of lug bars in drum.
-//
-#define NUM_LUG_BARS  27
 
 //! This defines how hard we are willing to work ar generating a key.
 //
@@ -64,22 +67,45 @@ extern bool Quiet;
 
 using namespace std;
 
-/// struct with  lug bars together iwth a score for their fit with Appendix II of the
-/// Technical Manual
-struct ScoredDrum {
-  array<bitset<NUM_WHEELS>, NUM_LUG_BARS> drum;
-  int score;
-  friend bool operator< (const ScoredDrum& lhs, const ScoredDrum& rhs)
-    {return lhs.score < rhs.score;}
-};
-
 
 //! This class simulates an M209 series cipher machine.
 //
 class M209 {
 public:
   
-  typedef array<bitset<NUM_WHEELS>, NUM_LUG_BARS> DrumType;
+  //! Number of pin wheels.
+  //
+  static constexpr int NUM_WHEELS = 6;
+  
+  //! Number of lug bars in drum.
+  //
+  static constexpr int NUM_LUG_BARS = 27;
+  
+  //! Suffix of a binary key file, written with --binaryKey
+  //
+  static constexpr const char* KEYFILE_SUFFIX_BIN = ".m209bin";
+  
+  //! Suffix of the key data base of a net in M209_KEYLIST_DIR
+  //
+  static constexpr const char* KEYDB_SUFFIX = ".m209db";
+  
+  /// The cipher engine: 27 bars, uniform stepping and a subtractive key
+  typedef HagelinMachine<NUM_LUG_BARS, NUM_WHEELS,
+                         UniformStep, SubtractiveKey> Engine;
+  
+  typedef Engine::DrumType DrumType;
+  
+  /// struct with lug bars together iwth a score for their fit with Appendix II of the
+  /// Technical Manual
+  struct ScoredDrum {
+    DrumType drum;
+    int score;
+    friend bool operator< (const ScoredDrum& lhs, const ScoredDrum& rhs)
+      {return lhs.score < rhs.score;}
+  };
+  
+  /// Least number of the best drums GenKey picks a drum from
+  static const int NUM_CANDIDATES = 25;
   
 private:
   
@@ -92,8 +118,22 @@ private:
   DrumType  Drum;
   
   //! Letter counter (a 4-digit counter in a real machine).
+  
+  //! Counts every letter since the counter was last zero, so it doesn't
+  //! overflow however long the message.
   //
-  int          LetterCounter;
+  uint64_t     LetterCounter;
+  
+  //! Verbosity and log stream used when loading keys and ciphering.
+  //
+  Context      Ctx;
+  
+  //! Key value produced by the drum for each of the 64 possible pin masks.
+  
+  //! Bit i of the index is the pin read from wheel i. Rebuilt by
+  //! BuildKeyTable() whenever the drum changes.
+  //
+  Engine::KeyStepTable KeyTable;
   
   /// The NumArrays contained in Appendix II Group A of the 1944 Tecnical
   /// Manual. Group A are the arrays without repeats.
@@ -104,7 +144,61 @@ private:
   static vector<array<int,6> > NumArrayAppendixIIB;
   
   
+  //! Recompute KeyTable from the current drum.
+  //
+  void BuildKeyTable(void);
+  
+  //! Mask of the pins currently read from the wheels, bit i for wheel i.
+  //
+  unsigned ReadPins(void) const;
+  
+  //! Trace of the letters ciphered in verbose mode
+  //
+  typedef Trace<vector<Keywheel>, NUM_WHEELS> LetterTrace;
+  
+  //! Encipher/Decipher one letter, passing it to trace, a NoTrace or a
+  //! LetterTrace.
+  //
+  template<class Tracer>
+  char CipherLetter(char c, Tracer& trace);
+  
+  /// Put the lugs given by NumArray and the overlaps on a drum
+  ScoredDrum MakeDrum(const array<int, NUM_WHEELS>& NumArray,
+                      const DrumCache::Overlaps& overlaps);
+  
+  /// Precomputed good drums used by GenKey1944 in place of GoodDrums, if
+  /// loaded
+  static std::shared_ptr<const DrumCatalog> Catalog;
+  
+  /// Set Drum to one of the best drums in Catalog for NumArray. Returns
+  /// 1 if it did, 0 if the catalog has no good drum for NumArray, and -1
+  /// if NumArray isn't in the catalog.
+  int CatalogDrum(const array<int, NUM_WHEELS>& NumArray);
+  
+  /// Number of NumArrays GenKey searches at once, on separate threads
+  unsigned SearchJobs;
+  
 public:
+  /// Good drums found so far, shared by all M209 objects. May be saved to
+  /// a file and loaded again to skip the searches in a later run.
+  static DrumCache DrumSearchCache;
+  
+  /// Wheels and drum of a key loaded from the keylist data base
+  struct KeyState {
+    vector<Keywheel> wheels;
+    DrumType drum;
+    Engine::KeyStepTable key_table;
+  };
+  
+  /// Keys loaded by LoadKey(date, ...), shared by all M209 objects, so
+  /// that messages on the same key don't read the key list again.
+  static KeyCache<KeyState> KeyListCache;
+  
+  /// Map a drum catalog written by hagelin-drumcatalog. GenKey1944 then
+  /// picks drums from it instead of searching. Throws std::runtime_error
+  /// if the file isn't a valid catalog.
+  static void LoadDrumCatalog(const string& fname);
+  
   
   //! Default constructor.
   //
@@ -116,11 +210,43 @@ public:
   ~M209() {}
   
   
+  //! Set the verbosity and log stream of this machine.
+  //
+  void SetContext(const Context& context) {
+    Ctx = context;
+  }
+  
+  //! The verbosity and log stream of this machine.
+  //
+  const Context& GetContext(void) const {
+    return Ctx;
+  }
+  
+  
   //! Encipher/Decipher one letter.
   //
   char Cipher(char c);
   
   
+  //! Key values (0-27) for length letters starting from StartPositions.
+  
+  //! StartPositions are the indicated wheel positions, 0 <= pos < wheel size.
+  //! The wheels all advance one position per letter, so the keystream is
+  //! fully determined by the start positions. The machine is not changed.
+  //
+  vector<unsigned char> Keystream(const array<int, NUM_WHEELS>& StartPositions,
+                                  size_t length) const;
+  
+  
+  //! Encipher/Decipher length letters from in to out.
+  
+  //! Equivalent to calling Cipher() on each letter, but computes the
+  //! keystream in bulk and applies it with CipherKernel. Wheels and letter
+  //! counter are advanced by length.
+  //
+  void CipherBuffer(const char* in, size_t length, char* out);
+  
+  
   //! Clear current key settings.
   //
   void ClearKey(void);
@@ -142,53 +268,118 @@ public:
   /// Load key for an istream using designated KeyListIndicator and NetIndicator
   void LoadKey(istream& keyfile, string&KeyListIndicator, string& NetIndicator);
   
-  /// Load key from keylist data base
+  /// Load key from keylist data base. The packed data base of the net is
+  /// used if there is one, else the text key file of the day.
   bool LoadKey(date d, string& KeyListIndicator, string& NetIndicator);
   
+  /// Return the current key as a KeyRecord
+  KeyRecord GetKeyRecord(const string& KeyListIndicator,
+                         const string& NetIndicator) const;
+  
+  /// Set the key from a KeyRecord. Throws std::invalid_argument if it
+  /// isn't a valid M209 key.
+  void SetKeyRecord(const KeyRecord& record);
+  
+  /// Load key from a binary key file, taking KeyListIndicator and
+  /// NetIndicator from it if present. Returns false if the file doesn't
+  /// exist and throws std::runtime_error if it isn't a key file.
+  bool LoadBinaryKey(const string& fname, string& KeyListIndicator,
+                     string& NetIndicator);
+  
+  /// Write the current key to a binary key file
+  bool SaveBinaryKey(const string& fname, const string& KeyListIndicator,
+                     const string& NetIndicator) const;
+  
   /// Generaate a random key using mehtod in Appendices of 1944 Technical Manual
   void GenKey1944(void);
   
+  /// Search up to jobs NumArrays for good drums at once in GenKey. The
+  /// same seed gives the same keys for any number of jobs.
+  void SetSearchJobs(unsigned jobs) {
+    SearchJobs = jobs;
+  }
+  
   //! Generate arrays similar to those in Appendix II of the 1944l
   /// Technical Manual
   void GenAppendixII(vector<array<int, 6> >& NumArrayA,
                      vector<array<int, 6> >& NumArrayB);
   
+  /// Return the NumArrays of Appendix II, group A then group B
+  static vector<array<int, NUM_WHEELS> > NumArrays();
+  
   /// Validate that a proposed drum satisfies the sum condition
-  bool ValidateDrum(DrumType drum);
+  bool ValidateDrum(const DrumType& drum) const;
   
   /// Geneate a list of all of the drums that are consistem with NumArray
-  /// and which satisfy the sum dest
+  /// and which satisfy the sum dest. Served from DrumSearchCache after the
+  /// first search for any permutation of NumArray.
   vector<ScoredDrum>
   GoodDrums(array<int, 6> NumArray, int& tries);
   
+  /// Call visit with the overlaps and score of each good drum for NumArray,
+  /// in search order, without putting them on drums. Returns the number of
+  /// good drums.
+  size_t GoodDrums(const array<int, NUM_WHEELS>& NumArray, int& tries,
+                   const DrumCache::VisitFunction& visit);
+  
+  /// Search for the overlaps of all the good drums for NumArray, in the
+  /// order they are found, without using DrumSearchCache. The search stops
+  /// early, with only the drums found so far, once *cancel is set.
+  DrumCache::Entry SearchDrums(const array<int, NUM_WHEELS>& NumArray,
+                               const std::atomic<bool>* cancel = nullptr);
+  
   //! Reset Letter Counter and Code Wheels.
   //
   void ResetCounter(void);
   
+  //! Number of letters after which all six code wheels are back in
+  //! their starting positions (the product of the wheel sizes).
+  static const uint64_t CYCLE = 26ULL * 25 * 23 * 21 * 19 * 17;
+  
+  //! Move the code wheels to letter letterIndex of the current message.
+  //
+  //! Letter 0 is the position the wheels had when the letter counter
+  //! was last zero (after SetWheels or ResetCounter). Each wheel turns
+  //! once per letter, so the position is found directly from the index
+  //! modulo the wheel size instead of stepping through the message.
+  //
+  void Seek(uint64_t letterIndex);
+  
   
   //! Set code wheel positions.
   //
   //! Supply at least six indicators. If more than
   //! six are provided, unusable indicators will be discarded.
+  //! The letter counter is reset on success.
   //! Returns true if successful, false if not.
   //
-  bool SetWheels(vector<string> indicator);
+  bool SetWheels(const vector<string>& indicator);
+  
+  
+  //! Set code wheel positions from count indicator names.
+  //
+  //! Same as SetWheels, but neither allocates nor throws, so it suits
+  //! loops which try many indicators.
+  //
+  bool TrySetPositions(const char* const* names, size_t count);
+  
   
+  //! Encipher/Decipher a stream.
   
-  //! Encipher/Decipher a stream, exit() on EOF.
+  //! Throws std::runtime_error if the message can't be processed, e.g.
+  //! if its key isn't found. The input is read and enciphered a chunk at a time. Unless Streaming
+  //! is set the output is held until the end so that the net indicator
+  //! line, with the group count, can go first. With Streaming it is
+  //! written as it is produced, memory use doesn't grow with the message,
+  //! and the net indicator line is left out.
   //
   void CipherStream(bool AutoKey,
                     bool AutoMsgIndicator,
                     string& KeyListIndicator,
                     string& NetIndicator,
                     string KeyDir, bool CipherMode,
-                    istream& InText, ostream& OutText);
-  
-  /// Convert bitset representation lugbar to lug positions
-  static void bitset2lugs(bitset<NUM_WHEELS> a, char& a1, char& a2);
-  
-  /// Compare two lugbars for sorting purposes
-  static bool CompareBars(bitset<NUM_WHEELS> a, bitset<NUM_WHEELS> b);
+                    istream& InText, ostream& OutText,
+                    bool Streaming = false);
 };
 
 
@@ -39,6 +39,9 @@ using std::random_shuffle;
 using std::accumulate;
 #include "config.h"
 #include "M209.h"
+#include "DrumCatalog.h"
+#include "TopReservoir.h"
+#include "FirstSuccess.h"
 
 /*
 //! Random number function for use with shuffle algorithm.
@@ -48,72 +51,88 @@ static ptrdiff_t doRandom(ptrdiff_t i) {
   return u_0_im1(gen);
 }
 */
-/// convert bitset representation to lugs
-void M209::bitset2lugs(bitset<NUM_WHEELS> a, char& a1, char& a2) {
-	vector<char> lugs;
-	for (int i = 0; i < NUM_WHEELS; ++i)
-		if (a[i]) lugs.push_back('1' + i);
-	if (lugs.size() == 0) {
-		a1 = '0';
-		a2 = '0';
-	}
-	else if (lugs.size() == 1) {
-		a1 = '0';
-		a2 = lugs[0];
-	}
-	else if (lugs.size() == 2) {
-		a1 = lugs[0];
-		a2 = lugs[1];
-	}
-	else {
-		throw std::runtime_error("M209::compare: More than two lugs present.");
-	}
-}
+DrumCache M209::DrumSearchCache;
+KeyCache<M209::KeyState> M209::KeyListCache;
+std::shared_ptr<const DrumCatalog> M209::Catalog;
 
-//! Compare two lug bars on the drum, for sorting.
-//
-//! Assumes no more than two lugs are active. Sorts based
-//! on the text representation of the lug settings.
-//
-bool M209::CompareBars(bitset <NUM_WHEELS> a, bitset <NUM_WHEELS> b) {
-  int   ai, bi;
-  char  a1, a2, b1, b2;
-  
-  bitset2lugs(a, a1, a2);
-  bitset2lugs(b, b1, b2);
-  
-  ai = ((int)a1 << 8) | a2;
-  bi = ((int)b1 << 8) | b2;
-  
-  return (ai < bi);
-}
+namespace {
 
+/// One level of the search in SearchDrums: the number of bars with lugs
+/// on both wheels i1 and i2.
 struct Combo {
   int i1;
   int i2;
-  array<int, NUM_WHEELS> NumArrayIn;
+  array<int, M209::NUM_WHEELS> NumArrayIn;
   int used;
 };
 
+} // namespace
+
 /// Validate that a proposed drum satisfies the sum requirement
-bool M209::ValidateDrum(DrumType drum) {
-  bitset<NUM_LUG_BARS+1> Sums(0);
-  for (size_t i=0; i< pow(2,NUM_WHEELS); ++i) {
-    bitset<NUM_WHEELS> pins(i);
-    int sum = 0;
-    for (int i=0; i<NUM_LUG_BARS; ++i)
-      sum += (drum.at(i) & pins).any();
-    Sums[sum] = 1;
+bool M209::ValidateDrum(const DrumType& drum) const {
+  return Engine::ValidateDrum(drum);
+}
+
+/// Put the lugs described by NumArray and overlaps on a drum: first the
+/// overlapping bars pair by pair, then the single lugs wheel by wheel.
+M209::ScoredDrum M209::MakeDrum(const array<int, NUM_WHEELS>& NumArray,
+                          const DrumCache::Overlaps& overlaps) {
+  array<int, NUM_WHEELS> num = NumArray;
+  ScoredDrum scored_drum;
+  int j=0;
+  // put the overlaps on the drum
+  if (Verbose) {
+    cerr << "Overlaps: " << endl;
+  }
+  scored_drum.score = DrumCache::Score(overlaps);
+  for (int i1=0; i1<NUM_WHEELS; ++i1) {
+    for (int i2=i1+1; i2<NUM_WHEELS; ++i2) {
+      int used = overlaps[DrumCache::PairIndex(i1, i2)];
+      for (int i=0; i<used; ++i) {
+        bitset<NUM_WHEELS> lugs(0);
+        lugs[i1]=1;
+        lugs[i2]=1;
+        if (Verbose) {
+          cerr << j << " " << lugs << endl;
+        }
+        scored_drum.drum.at(j++) = lugs;
+        num.at(i1)--;
+        num.at(i2)--;
+      }
+    }
+  }
+  // put the singletons on the drum
+  if (Verbose) {
+    cerr << endl << "Singletons :" << endl;
+  }
+  for (int l=0; l<NUM_WHEELS; ++l) {
+    for (int i=0; i<num.at(l); ++i) {
+      bitset<NUM_WHEELS> lugs(0);
+      lugs[l]=1;
+      if (Verbose) {
+        cerr << j << " " << lugs << endl;
+      }
+      scored_drum.drum.at(j++) = lugs;
+    }
   }
-  return Sums.all();
+  for (int i=0; i<NUM_WHEELS; ++i) {
+    int sum =0;
+    for (int j=0; j<NUM_LUG_BARS; ++j) {
+      sum += scored_drum.drum.at(j)[i];
+    }
+    if (sum != NumArray[i])
+      throw std::runtime_error("Drum sums don't match NumArray");
+    
+  }
+  return scored_drum;
 }
 
-/// return a list of all the lugbars that are consistent with the NumArray
-/// and that satisfy the sum test
-vector<ScoredDrum>
-M209::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
-  tries = 0;
-  vector<ScoredDrum> ret;
+/// return the overlaps of all the lugbars that are consistent with the
+/// NumArray and that satisfy the sum test
+DrumCache::Entry M209::SearchDrums(const array<int, NUM_WHEELS>& NumArray,
+                                   const std::atomic<bool>* cancel) {
+  DrumCache::Entry ret;
+  ret.tries = 0;
   // Goal is to determine all possible overlaps
   // limits the number of overlaps between any two positions to 4
   int overlaps = accumulate(NumArray.begin(), NumArray.end(), 0)-NUM_LUG_BARS;
@@ -130,8 +149,14 @@ M209::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
       
     }
   }
+  // The keys each pattern of pins can still give, to prune branches that
+  // can't pass the sum test
+  PartialSums<NUM_WHEELS> sums(NumArray, NUM_LUG_BARS);
+  int pruned = 0;
   int k=0;       //the index in combos
   while (k>=0) {
+    if (cancel && *cancel)
+      break;
     Combo& c = combos.at(k);
     if (Verbose) {
       cerr << "level = " << k << ", i1 = " << c.i1 << ", i2 = " << c.i2;
@@ -148,9 +173,11 @@ M209::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
         break;
       else{
         overlaps += c.used;
+        sums.Add(k, -c.used);
         c.used = 0;
         k--;
         combos.at(k).used++;
+        sums.Add(k, 1);
         overlaps--;
         continue;
       }
@@ -159,80 +186,57 @@ M209::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
       if (overlaps <= c.NumArrayIn[c.i1]
           && overlaps <= c.NumArrayIn[c.i2]
           && overlaps <= 4) {
+        sums.Add(k, overlaps - c.used);
         c.used = overlaps;
         overlaps=0;
       } else {
         // go back up
         overlaps += c.used;
+        sums.Add(k, -c.used);
         c.used = 0;
         k--;
         combos.at(k).used++;
+        sums.Add(k, 1);
         overlaps--;
         continue;
 
       }
     }
+    ret.tries++;
+    bool possible = sums.CanCover(k, overlaps, 4);
+    pruned += !possible;
     if (overlaps == 0) {
-      array<int, NUM_WHEELS> num = NumArray;
-      ScoredDrum scored_drum;
-      int j=0;
-      // put the overlaps on the drum
-      if (Verbose) {
-        cerr << "Overlaps: " << endl;
-      }
-      scored_drum.score = 0;
-      for (int k1=0; k1<=k; ++k1) {
-        scored_drum.score += combos.at(k1).used > 0;
-        for (int i=0; i<combos.at(k1).used; ++i) {
-          bitset<NUM_WHEELS> lugs(0);
-          lugs[combos.at(k1).i1]=1;
-          lugs[combos.at(k1).i2]=1;
-          if (Verbose) {
-            cerr << j << " " << lugs << endl;
-          }
-          scored_drum.drum.at(j++) = lugs;
-          num.at(combos.at(k1).i1)--;
-          num.at(combos.at(k1).i2)--;
+      if (possible) {
+        DrumCache::Overlaps used;
+        used.fill(0);
+        for (int k1=0; k1<=k; ++k1) {
+          used[DrumCache::PairIndex(combos.at(k1).i1, combos.at(k1).i2)] =
+            combos.at(k1).used;
         }
+        ScoredDrum scored_drum = MakeDrum(NumArray, used);
+        if (ValidateDrum(scored_drum.drum))
+          ret.overlaps.push_back(used);
       }
-      // put the singletons on the drum
-      if (Verbose) {
-        cerr << endl << "Singletons :" << endl;
-      }
-      for (int l=0; l<NUM_WHEELS; ++l) {
-        for (int i=0; i<num.at(l); ++i) {
-          bitset<NUM_WHEELS> lugs(0);
-          lugs[l]=1;
-          if (Verbose) {
-            cerr << j << " " << lugs << endl;
-          }
-          scored_drum.drum.at(j++) = lugs;
-        }
-      }
-      tries++;
-      for (int i=0; i<NUM_WHEELS; ++i) {
-        int sum =0;
-        for (int j=0; j<NUM_LUG_BARS; ++j) {
-          sum += scored_drum.drum.at(j)[i];
-        }
-        if (sum != NumArray[i])
-          throw std::runtime_error("Drum sums don't match NumArray");
-
-      }
-      
-      if (ValidateDrum(scored_drum.drum))
-        ret.push_back(scored_drum);
       // Go back up
       overlaps += c.used;
+      sums.Add(k, -c.used);
       c.used = 0;
       k--;
       if (k<0)
         break;
       combos.at(k).used++;
+      sums.Add(k, 1);
       overlaps--;
       continue;
 
     } // overlaps == 0
+    if (!possible) {
+      // Try the next number of overlaps at this level
+      c.used++;
+      sums.Add(k, 1);
+      overlaps--;
+      continue;
+    }
     // Go down
     k++;
     combos.at(k).used = 0;
@@ -244,10 +248,64 @@ M209::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
     continue;
     
   }
+  if (Verbose) {
+    cerr << "SearchDrums: " << ret.tries << " branches visited, "
+         << pruned << " pruned, " << ret.overlaps.size() << " good drums" << endl;
+  }
   
   return ret;
 }
 
+/// return a list of all the lugbars that are consistent with the NumArray
+/// and that satisfy the sum test
+vector<M209::ScoredDrum>
+M209::GoodDrums(array<int, NUM_WHEELS> NumArray, int& tries) {
+  vector<ScoredDrum> ret;
+  GoodDrums(NumArray, tries,
+            [&](const DrumCache::Overlaps& o, int) {
+              ret.push_back(MakeDrum(NumArray, o));
+            });
+  return ret;
+}
+
+/// call visit with the overlaps and score of each good drum for the
+/// NumArray, in search order, without putting them on drums
+size_t M209::GoodDrums(const array<int, NUM_WHEELS>& NumArray, int& tries,
+                       const DrumCache::VisitFunction& visit) {
+  return Engine::GoodDrums(DrumSearchCache, NumArray, tries,
+                           [this](const DrumCache::NumArrayType& sorted) {
+                             return SearchDrums(sorted);
+                           }, visit);
+}
+
+/// Map the drum catalog in file fname for use by GenKey1944
+void M209::LoadDrumCatalog(const string& fname) {
+  Catalog = std::make_shared<const DrumCatalog>(fname);
+}
+
+/// Pick a drum for NumArray from the catalog, if it's there
+int M209::CatalogDrum(const array<int, NUM_WHEELS>& NumArray) {
+  array<int, NUM_WHEELS> perm;
+  DrumCache::NumArrayType sorted;
+  DrumCache::SortWheels(NumArray, perm, sorted);
+  const DrumCatalog::Entry* entry = Catalog->Find(sorted);
+  if (!entry)
+    return -1;
+  if (entry->candidates == 0)
+    return 0;
+  uniform_int_distribution<int> dist_drum(0, static_cast<int>(entry->candidates-1));
+  DrumCatalog::Bars bars = Catalog->Drum(*entry, dist_drum(gen));
+  // Bit c of a catalog bar is wheel perm[c] of NumArray
+  for (int b=0; b<NUM_LUG_BARS; ++b) {
+    bitset<NUM_WHEELS> lugs(0);
+    for (int c=0; c<NUM_WHEELS; ++c) {
+      lugs[perm[c]] = (bars[b] >> c) & 1;
+    }
+    Drum.at(b) = lugs;
+  }
+  return 1;
+}
+
 /// Generate a key using the method descibed in the Appendices of the
 /// 1944 Technical Manual
 void M209::GenKey1944() {
@@ -278,41 +336,91 @@ void M209::GenKey1944() {
    not succeed each other in a key list.
    */
   
-  // Find a NumArray that has at least one good drum
-  vector<ScoredDrum> good_drums;
+  // Find a NumArray that has at least one good drum. Only the best
+  // candidates are kept: every drum with the best score or, if fewer than
+  // NUM_CANDIDATES have it, the NUM_CANDIDATES best drums.
+  TopReservoir<DrumCache::Overlaps> candidates(NUM_CANDIDATES);
+  array<int, NUM_WHEELS> NumArray;
   int tries;
-  do {
+  int from_catalog = -1;
+  auto DrawNumArray = [this](ChaChaRandom& g) {
     bernoulli_distribution dist_A(.9);
-    bool A = dist_A(gen);
+    bool A = dist_A(g);
     vector<array<int, 6> >& NumArrays = A ? NumArrayAppendixIIA : NumArrayAppendixIIB;
     uniform_int_distribution<int> dist(0, static_cast<int>(NumArrays.size()-1));
-    array<int, 6> NumArray = NumArrays[dist(gen)];
-    shuffle(NumArray.begin(), NumArray.end(), gen);
-    good_drums = GoodDrums(NumArray, tries);
-  } while (good_drums.size() == 0);
-  
-  // Sort the good drums and randomly pick one from the best candidates.
-  sort(good_drums.begin(), good_drums.end());
-  int best_score = good_drums.back().score;
-  int num_best_score=0;
-  for (auto itr = good_drums.begin(); itr<good_drums.end(); ++itr){
-    num_best_score += ((*itr).score == best_score);
+    array<int, NUM_WHEELS> NumArray = NumArrays[dist(g)];
+    shuffle(NumArray.begin(), NumArray.end(), g);
+    return NumArray;
+  };
+  // NumArray n is drawn from stream n of a seed taken once from gen, so
+  // that the NumArrays and the use of gen after them don't depend on how
+  // many are searched at once.
+  uint64_t draw_seed = gen();
+  draw_seed = draw_seed << 32 | gen();
+  uint64_t draw_stream = 0;
+  std::function<array<int, NUM_WHEELS>()> DrawNext = [&]() {
+    ChaChaRandom g(draw_seed, draw_stream++);
+    return DrawNumArray(g);
+  };
+  if (SearchJobs > 1 && !Catalog) {
+    // Search SearchJobs NumArrays at a time, keeping the first in the
+    // order drawn that has a good drum, as the loop below does. Which
+    // NumArrays are searched but not kept depends on the timing of the
+    // threads, but they don't use gen.
+    vector<DrumCache::Overlaps> found;
+    FirstSuccess<array<int, NUM_WHEELS>, vector<DrumCache::Overlaps> >(
+      SearchJobs, DrawNext,
+      [this](const array<int, NUM_WHEELS>& num,
+             vector<DrumCache::Overlaps>& overlaps,
+             const std::atomic<bool>& cancel) {
+        int tries;
+        overlaps = DrumSearchCache.Lookup(num, tries,
+                     [this, &cancel](const DrumCache::NumArrayType& sorted) {
+                       return SearchDrums(sorted, &cancel);
+                     }, &cancel);
+        return !overlaps.empty();
+      }, NumArray, found);
+    for (auto& o : found) {
+      candidates.Offer(DrumCache::Score(o), o, gen);
+    }
+  } else {
+    do {
+      candidates.clear();
+      NumArray = DrawNext();
+      if (Catalog) {
+        from_catalog = CatalogDrum(NumArray);
+        if (from_catalog == 1)
+          break;
+        if (from_catalog == 0)
+          continue;
+      }
+      GoodDrums(NumArray, tries,
+                [&](const DrumCache::Overlaps& o, int score) {
+                  candidates.Offer(score, o, gen);
+                });
+    } while (candidates.empty());
   }
-  int num_candidates = std::min(static_cast<int>(good_drums.size()),
-                                std::max(25,num_best_score));
   
-  // Randomly select from the list of candidates
-  // The good ones are at the end
-  uniform_int_distribution<int> dist_drum(0,num_candidates-1);
-  Drum = (*(good_drums.rbegin()+dist_drum(gen))).drum;
+  if (from_catalog != 1) {
+    // Randomly select from the candidates
+    Drum = MakeDrum(NumArray, candidates.Pick(gen)).drum;
+  }
   
   // Sort the bars to make it easier for the operator to set them
   // in a real machine
-  sort(Drum.begin(), Drum.end(), CompareBars);
+  sort(Drum.begin(), Drum.end(), Engine::CompareBars);
+  BuildKeyTable();
   
 
 }
 
+/// Return the NumArrays of Appendix II
+vector<array<int, M209::NUM_WHEELS> > M209::NumArrays() {
+  vector<array<int, NUM_WHEELS> > ret = NumArrayAppendixIIA;
+  ret.insert(ret.end(), NumArrayAppendixIIB.begin(), NumArrayAppendixIIB.end());
+  return ret;
+}
+
 /// Generate the Number Lists in Appendix II of the 1944 Technical Manual
 void M209::GenAppendixII(vector<array<int, 6> >& NumArrayA,
                          vector<array<int, 6> >& NumArrayB) {
@@ -0,0 +1,158 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file PinSampler.cc
+ * \brief Implementation of PinSampler class member functions.
+ * \package hagelin
+ */
+
+#include <algorithm>
+
+#include "PinSampler.h"
+
+//! Least number of active pins on a valid wheel of size pins (40%).
+//
+static int MinWeight(int size) {
+  return (4 * size + 9) / 10;
+}
+
+
+//! Greatest number of active pins on a valid wheel of size pins (60%).
+//
+static int MaxWeight(int size) {
+  return 6 * size / 10;
+}
+
+
+PinSampler::PinSampler(int maxRun) : MaxRun(maxRun) {
+  if (maxRun < 1 || maxRun > MAX_RUN) {
+    throw std::invalid_argument("PinSampler::PinSampler(): bad run limit");
+  }
+  Strings.assign(Index(MAX_SIZE + 1, 0, 0, 0), 0);
+  for (int len = 1; len <= MAX_SIZE; ++len) {
+    for (int ones = 0; ones <= len; ++ones) {
+      for (int first = 0; first < 2; ++first) {
+        for (int last = 0; last < 2; ++last) {
+          uint64_t n = 0;
+          for (int r = 1; r <= std::min(MaxRun, len); ++r) {
+            n += Starting(len, ones, first, last, r);
+          }
+          Strings[Index(len, ones, first, last)] = n;
+        }
+      }
+    }
+  }
+  Totals.assign(MAX_SIZE + 1, 0);
+  for (int size = 1; size <= MAX_SIZE; ++size) {
+    uint64_t n = 0;
+    for (int first = 0; first < 2; ++first) {
+      // a pins at the start and s at the end form the run through 0
+      for (int a = 1; a <= MaxRun; ++a) {
+        for (int s = 0; a + s <= MaxRun && a + s < size; ++s) {
+          for (int w = MinWeight(size); w <= MaxWeight(size); ++w) {
+            int ones = w - (first ? a + s : 0);
+            if (ones >= 0) {
+              n += Strings[Index(size - a - s, ones, !first, !first)];
+            }
+          }
+        }
+      }
+    }
+    Totals[size] = n;
+  }
+}
+
+
+uint64_t PinSampler::Starting(int len, int ones, int first, int last,
+                              int r) const {
+  int run_ones = first ? r : 0;
+  if (r == len) {
+    return first == last && ones == run_ones;
+  }
+  if (ones < run_ones) {
+    return 0;
+  }
+  return Strings[Index(len - r, ones - run_ones, !first, last)];
+}
+
+
+uint64_t PinSampler::Count(int size) const {
+  if (size < 1 || size > MAX_SIZE) {
+    throw std::invalid_argument("PinSampler::Count(): bad wheel size");
+  }
+  return Totals[size];
+}
+
+
+uint64_t PinSampler::Pattern(int size, uint64_t index) const {
+  if (size < 1 || size > MAX_SIZE) {
+    throw std::invalid_argument("PinSampler::Pattern(): bad wheel size");
+  }
+  // Walk the terms of Count() to the one holding index
+  for (int first = 0; first < 2; ++first) {
+    for (int a = 1; a <= MaxRun; ++a) {
+      for (int s = 0; a + s <= MaxRun && a + s < size; ++s) {
+        for (int w = MinWeight(size); w <= MaxWeight(size); ++w) {
+          int ones = w - (first ? a + s : 0);
+          if (ones < 0) {
+            continue;
+          }
+          int len = size - a - s;
+          int bit = !first;
+          uint64_t n = Strings[Index(len, ones, bit, bit)];
+          if (index >= n) {
+            index -= n;
+            continue;
+          }
+          
+          // Then choose the runs of the string between the ends the same way
+          uint64_t pins = 0;
+          if (first) {
+            pins = (uint64_t(1) << a) - 1;
+            if (s > 0) {
+              pins |= ((uint64_t(1) << s) - 1) << (size - s);
+            }
+          }
+          int pos = a;
+          int last = bit;
+          while (len > 0) {
+            int r;
+            for (r = 1; r < std::min(MaxRun, len); ++r) {
+              uint64_t m = Starting(len, ones, bit, last, r);
+              if (index < m) {
+                break;
+              }
+              index -= m;
+            }
+            if (bit) {
+              pins |= ((uint64_t(1) << r) - 1) << pos;
+              ones -= r;
+            }
+            pos += r;
+            len -= r;
+            bit = !bit;
+          }
+          return pins;
+        }
+      }
+    }
+  }
+  throw std::invalid_argument("PinSampler::Pattern(): index out of range");
+}
@@ -0,0 +1,116 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file PinSampler.h
+ * \brief Definition of the PinSampler class.
+ * \package hagelin
+ */
+
+#ifndef _PINSAMPLER_H_
+#define _PINSAMPLER_H_
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+using std::vector;
+
+
+/*!
+ * \brief Draws random pin settings for a key wheel in a single pass.
+ *
+ * A valid setting has 40% to 60% of its pins active and no more than
+ * MaxRun consecutive pins with the same setting, counting runs around
+ * the wheel. Count() gives the number of valid settings for a wheel
+ * size and Pattern() numbers them, so one uniform random number picks
+ * a setting with every valid setting equally likely, which is what
+ * drawing pins and retrying until the setting is valid gives.
+ *
+ * The counts come from a table of the number of pin strings with no
+ * long runs by length, active pins, first pin and last pin. A setting
+ * is counted as its run through position 0, whose length is limited to
+ * MaxRun in total, and the string of the other runs.
+ */
+class PinSampler {
+
+private:
+
+    //! Longest allowed run of pins with the same setting.
+    //
+    int			MaxRun;
+
+    //! Number of pin strings with no run longer than MaxRun, indexed by
+    //! Index(length, active pins, first pin, last pin).
+    //
+    vector<uint64_t>	Strings;
+
+    //! Number of valid settings by wheel size.
+    //
+    vector<uint64_t>	Totals;
+
+    static size_t Index(int len, int ones, int first, int last) {
+      return ((size_t(len) * (MAX_SIZE + 1) + ones) * 2 + first) * 2 + last;
+    }
+
+    //! Number of strings in Strings(len, ones, first, last) which begin
+    //! with a run of r pins.
+    //
+    uint64_t Starting(int len, int ones, int first, int last, int r) const;
+
+public:
+
+    //! Largest wheel size.
+    //
+    static const int	MAX_SIZE = 64;
+
+    //! Longest run limit for which the counts fit in 64 bits.
+    //
+    static const int	MAX_RUN = 6;
+
+    //! Build the tables for runs of at most maxRun pins.
+    //
+    //! Throws std::invalid_argument unless 1 <= maxRun <= MAX_RUN.
+    //
+    explicit PinSampler(int maxRun);
+
+    //! Return the number of valid settings for a wheel of size pins.
+    //
+    uint64_t Count(int size) const;
+
+    //! Return valid setting number index, bit i for position i.
+    //
+    //! Throws std::invalid_argument unless index < Count(size).
+    //
+    uint64_t Pattern(int size, uint64_t index) const;
+
+    //! Return a valid setting drawn uniformly using g.
+    //
+    template<class URBG>
+    uint64_t Sample(int size, URBG& g) const {
+      uint64_t count = Count(size);
+      if (count == 0) {
+        throw std::invalid_argument("PinSampler::Sample(): no valid setting");
+      }
+      std::uniform_int_distribution<uint64_t> dist(0, count - 1);
+      return Pattern(size, dist(g));
+    }
+};
+
+#endif /* _PINSAMPLER_H_ */
@@ -0,0 +1,150 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file SumCoverage.h
+ * \brief The sum test on a drum, used by M209 and C52 ValidateDrum and
+ *        SearchDrums.
+ * \package hagelin
+ */
+
+#ifndef _SUMCOVERAGE_H_
+#define _SUMCOVERAGE_H_
+
+#include <cstdint>
+#include <array>
+#include <bitset>
+#include <algorithm>
+
+
+/*!
+ * \brief Check that a drum can produce every key from 0 to its number of bars.
+ *
+ * The drum is given transposed: bit b of WheelBars[w] is set if bar b has
+ * a lug on wheel w. The bars moved by a pin pattern are then the OR of the
+ * masks of its effective wheels, and the key is their count. The patterns
+ * are built up one wheel at a time, each from a smaller one, and the test
+ * stops as soon as every key has been seen.
+ */
+template <size_t WHEELS>
+bool CoversAllSums(const std::array<uint32_t, WHEELS>& WheelBars, int bars) {
+  static_assert(WHEELS < 8, "CoversAllSums: too many wheels");
+  const uint64_t all = (uint64_t(1) << (bars + 1)) - 1;
+  uint32_t moved[1 << WHEELS];
+  uint64_t sums = 1;            // no effective pins, key 0
+  moved[0] = 0;
+  for (size_t w=0; w<WHEELS; ++w) {
+    for (size_t p=0; p<(size_t(1) << w); ++p) {
+      uint32_t m = moved[p] | WheelBars[w];
+      moved[p | (size_t(1) << w)] = m;
+      sums |= uint64_t(1) << std::bitset<32>(m).count();
+    }
+    if (sums == all)
+      return true;
+  }
+  return sums == all;
+}
+
+/*!
+ * \brief The sums of a drum whose overlapping bars are still being chosen.
+ *
+ * Each bar carries at most two lugs, so the key for a pin pattern is the
+ * sum of NumArray over its effective wheels less the number of bars with
+ * lugs on two of them. SearchDrums chooses the overlaps pair by pair in
+ * the order (0,1), (0,2), ... (4,5); level l of the search is pair l.
+ * Sum keeps, for every pattern, NumArray less the overlaps chosen so far,
+ * so once the overlaps of the pairs after level l are bounded the keys
+ * each pattern can still reach are known.
+ */
+template <size_t WHEELS>
+class PartialSums {
+
+public:
+
+    //! Number of pairs of wheels, and of levels in the search.
+    //
+    static const int PAIRS = WHEELS * (WHEELS - 1) / 2;
+
+    //! No overlaps chosen. bars is the number of bars that count.
+    //
+    PartialSums(const std::array<int, WHEELS>& NumArray, int bars)
+    : Bars(bars) {
+      static_assert(WHEELS < 8, "PartialSums: too many wheels");
+      int l = 0;
+      for (size_t i=0; i<WHEELS; ++i) {
+        for (size_t j=i+1; j<WHEELS; ++j)
+          PairMask[l++] = (1u << i) | (1u << j);
+      }
+      for (unsigned p=0; p<PATTERNS; ++p) {
+        Sum[p] = 0;
+        for (size_t i=0; i<WHEELS; ++i) {
+          if (p & (1u << i))
+            Sum[p] += NumArray[i];
+        }
+        int later = 0;
+        for (int l=PAIRS-1; l>=0; --l) {
+          Later[l][p] = later;
+          later += (p & PairMask[l]) == PairMask[l];
+        }
+      }
+    }
+
+    //! Add delta bars with lugs on both wheels of pair l.
+    //
+    void Add(int l, int delta) {
+      for (unsigned p=0; p<PATTERNS; ++p) {
+        if ((p & PairMask[l]) == PairMask[l])
+          Sum[p] -= delta;
+      }
+    }
+
+    //! Check whether every key from 0 to bars can still be produced when
+    //! the remaining overlaps, at most maxPair per pair, go to the pairs
+    //! after level l.
+    //
+    bool CanCover(int l, int remaining, int maxPair) const {
+      const uint64_t all = (uint64_t(1) << (Bars + 1)) - 1;
+      uint64_t sums = 0;
+      for (unsigned p=0; p<PATTERNS; ++p) {
+        int later = Later[l][p];
+        int hi = Sum[p];
+        int lo;
+        if (later == PAIRS - 1 - l)
+          lo = hi = hi - remaining;   // every later pair is in the pattern
+        else
+          lo = hi - std::min(remaining, maxPair * later);
+        lo = std::max(lo, 0);
+        hi = std::min(hi, Bars);
+        if (lo <= hi)
+          sums |= ((uint64_t(2) << hi) - 1) & ~((uint64_t(1) << lo) - 1);
+      }
+      return sums == all;
+    }
+
+private:
+
+    static const unsigned PATTERNS = 1u << WHEELS;
+
+    int       Bars;
+    unsigned  PairMask[PAIRS];            //!< the two wheels of each pair
+    int       Sum[PATTERNS];              //!< NumArray less chosen overlaps
+    int       Later[PAIRS][PATTERNS];     //!< pairs after each level in each pattern
+};
+
+#endif // _SUMCOVERAGE_H_
@@ -0,0 +1,123 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+/*!
+ * \file TopReservoir.h
+ * \brief Definition of the TopReservoir class template.
+ * \package hagelin
+ */
+
+#ifndef _TOPRESERVOIR_H_
+#define _TOPRESERVOIR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+using std::vector;
+
+
+/*!
+ * \brief Keeps the highest scoring of a stream of items.
+ *
+ * At most Capacity items are kept. Items with equal scores are ranked by
+ * a random key, so when more of them tie than there is room for, each is
+ * equally likely to be kept. A uniform pick from the reservoir is then a
+ * uniform pick from the items with the best score if at least Capacity
+ * items have it, and otherwise from the Capacity best items.
+ */
+template<class Item>
+class TopReservoir {
+
+private:
+
+    struct Entry {
+      int       score;
+      uint32_t  key;      //!< random rank among equal scores
+      Item      item;
+    };
+
+    //! True if a ranks above b.
+    //
+    static bool Above(const Entry& a, const Entry& b) {
+      return a.score > b.score || (a.score == b.score && a.key > b.key);
+    }
+
+    //! Items kept, as a heap with the lowest ranked at the front.
+    //
+    vector<Entry>  Heap;
+
+    size_t         Capacity;
+
+public:
+
+    explicit TopReservoir(size_t capacity) : Capacity(capacity) {
+      Heap.reserve(capacity);
+    }
+
+    //! Offer an item, keeping it if it ranks among the best Capacity.
+    //
+    template<class URBG>
+    void Offer(int score, const Item& item, URBG& g) {
+      if (Capacity == 0 ||
+          (Heap.size() == Capacity && score < Heap.front().score)) {
+        return;
+      }
+      std::uniform_int_distribution<uint32_t> dist_key;
+      Entry e{score, dist_key(g), item};
+      if (Heap.size() < Capacity) {
+        Heap.push_back(e);
+        std::push_heap(Heap.begin(), Heap.end(), Above);
+      } else if (Above(e, Heap.front())) {
+        std::pop_heap(Heap.begin(), Heap.end(), Above);
+        Heap.back() = e;
+        std::push_heap(Heap.begin(), Heap.end(), Above);
+      }
+    }
+
+    //! Return a uniformly chosen item of those kept.
+    //
+    //! Throws std::logic_error if none are.
+    //
+    template<class URBG>
+    const Item& Pick(URBG& g) const {
+      if (Heap.empty()) {
+        throw std::logic_error("TopReservoir::Pick(): empty reservoir");
+      }
+      std::uniform_int_distribution<size_t> dist(0, Heap.size() - 1);
+      return Heap[dist(g)].item;
+    }
+
+    //! Number of items kept.
+    //
+    size_t size(void) const {
+      return Heap.size();
+    }
+
+    bool empty(void) const {
+      return Heap.empty();
+    }
+
+    void clear(void) {
+      Heap.clear();
+    }
+};
+
+#endif /* _TOPRESERVOIR_H_ */
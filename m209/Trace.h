@@ -0,0 +1,137 @@
+/**************************************************************************
+ * Copyright (C) 2019 Joseph Dunn
+ *
+ * This file is part of Hagelin.
+ *
+ *  Hagelin is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Hagelin is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Hagelin.  If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************************/
+
+
+/*!
+ * \file Trace.h
+ * \brief Tracing policies for the cipher loops of M209 and C52.
+ * \package hagelin
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+
+/*!
+ * \brief Tracing policy that records nothing.
+ *
+ * A cipher loop instantiated with NoTrace has no trace code left in it.
+ */
+struct NoTrace {
+  
+  /// Ignore the letter
+  void Letter(uint64_t, unsigned, char, int, char) {}
+};
+
+
+/*!
+ * \brief Tracing policy that records every letter for the verbose trace.
+ *
+ * Letters are recorded in a preallocated buffer as wheel positions and
+ * pin masks. They are formatted into trace lines, the same lines the
+ * machines have always printed with -v, only when the buffer is full and
+ * when the Trace is destroyed, so that a traced loop doesn't format and
+ * flush the log for each letter. The wheels must keep their position
+ * names while the Trace exists.
+ */
+template<class Wheels, size_t NumWheels>
+class Trace {
+  
+  /// One traced letter
+  struct Record {
+    uint64_t counter;                              ///< letter counter
+    std::array<unsigned char, NumWheels> pos;      ///< wheel positions
+    std::array<unsigned char, NumWheels> read;     ///< pins read
+    unsigned char pins;                            ///< pin values
+    char in;                                       ///< input letter
+    signed char key;                               ///< key value
+    char out;                                      ///< output letter
+  };
+  
+  const Wheels&        wheels;
+  std::ostream&        log;
+  std::vector<Record>  records;
+  size_t               size;
+  
+public:
+  
+  /// Trace letters ciphered with wheels to log, keeping up to capacity
+  /// letters before formatting them
+  Trace(const Wheels& wheels, std::ostream& log, size_t capacity = 4096)
+  : wheels(wheels), log(log), records(capacity), size(0) {}
+  
+  ~Trace() {
+    Flush();
+  }
+  
+  /// Record a letter, before the wheels advance past it
+  void Letter(uint64_t counter, unsigned pins, char in, int key, char out) {
+    if (size == records.size()) {
+      Flush();
+    }
+    Record& r = records[size++];
+    r.counter = counter;
+    for (size_t i=0; i<NumWheels; i++) {
+      r.pos[i] = wheels[i].GetPosition();
+      r.read[i] = wheels[i].GetReadPos();
+    }
+    r.pins = pins;
+    r.in = in;
+    r.key = key;
+    r.out = out;
+  }
+  
+  /// Format the recorded letters to the log
+  void Flush() {
+    using std::setfill;
+    using std::setw;
+    for (size_t n=0; n<size; n++) {
+      const Record& r = records[n];
+      log << "Counter: "
+      << setfill('0') << setw(4) << std::dec << r.counter
+      << "  Wheels: ";
+      for (size_t i=0; i<NumWheels; i++) {
+        log << wheels[i].GetPosNameAt(r.pos[i]);
+      }
+      log << "  Pin Positions: ";
+      for (size_t i=0; i<NumWheels; i++) {
+        log << wheels[i].GetPosNameAt(r.read[i]);
+      }
+      log << "  Pin Values: ";
+      for (size_t i=0; i<NumWheels; i++) {
+        log << ((r.pins >> i) & 1);
+      }
+      log << "  In: " << r.in
+      << "  Key: " << setfill(' ') << setw(2) << int(r.key)
+      << "  Out: " << r.out
+      << '\n';
+    }
+    size = 0;
+    log.flush();
+  }
+};
+
+#endif // _TRACE_H_
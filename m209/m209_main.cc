@@ -30,6 +30,7 @@ using std::cerr;
 #include <fstream>
 using std::ifstream;
 using std::ofstream;
+#include <stdexcept>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
@@ -37,6 +38,7 @@ using std::ofstream;
 #define SOURCE
 #include "config.h"
 #include "M209.h"
+#include "Batch.h"
 #include "KeyListDataBase.hpp"
 
 //! If true, enable verbose debugging messages to stderr.
@@ -78,13 +80,21 @@ int main(int argc, char **argv)
   string  FileOut;
   bool    AutoKey = false;
   bool    AutoMsgIndicator = false;
-  vector<string>  indicator(NUM_WHEELS,"A");
+  vector<string>  indicator(M209::NUM_WHEELS,"A");
   string KeyFileName;
   string    KeyListIndicator;
   int      i;
   string    KeyDir = ".";
   string    NetIndicator;
   size_t      SkipChars = 0;
+  uint64_t    SeekLetter = 0;
+  uint64_t    Seed = 0;
+  string    DrumCatalogFile;
+  bool      Streaming = false;
+  string    BinaryKeyFile;
+  bool      Batch = false;
+  unsigned  Jobs = 1;
+  bool      Failed = false;
   
   // Parse command-line arguments
   options_description desc("m209 options description");
@@ -103,14 +113,22 @@ int main(int argc, char **argv)
   (",l", value<string>(&KeyListIndicator), "Use specified two-letter key list indicator.")
   (",n", value<string>(&NetIndicator), "Specify a net indicator for use in -a or -p modes.\nMust be a single word consisting of only letters and/or numbers.")
   (",p", "print key settings to cout")
+  ("binaryKey", value<string>(&BinaryKeyFile), "Write the key setting to the specified file in the\nbinary format read by -k and -t for .m209bin files.")
   (",s", value<size_t>(&SkipChars),"Skip number of leading characters specified in following argument.")
+  ("seek", value<uint64_t>(&SeekLetter), "The input starts at the letter of the message with\nthe following index, counting from 0. The wheels are\nmoved there directly. Requires -i.")
   (",t", value<string>(&KeyDir), "Specify directory containing key files for -a mode.\nDefault is current directory.")
+  ("seed", value<uint64_t>(&Seed), "Seed the random number generator so that\ngenerated keys and indicators can be reproduced.")
+  ("drumCatalog", value<string>(&DrumCatalogFile), "Pick generated drums from a catalog written by\nhagelin-drumcatalog instead of searching.")
+  ("batch", bool_switch(&Batch), "Process a series of messages separated by lines\nholding only " BATCH_SEPARATOR ". The outputs are separated\nthe same way, and a message that fails is reported\nwithout stopping the others.")
+  (",j", value<unsigned>(&Jobs), "Number of messages to process in parallel\nin --batch mode, or of drum searches to run\nat once with -g.")
+  ("stream", bool_switch(&Streaming), "Write the output as the input is read, in constant\nmemory. The net indicator line is left out.")
   (",q", bool_switch(&Quiet), "Suppress informational messages.")
   (",v", bool_switch(&Verbose), "Print verbose debug messages to stderr.");
   
   variables_map vm;
   store(parse_command_line(argc, argv, desc), vm);
   notify(vm);
+  m209.SetContext(Context());
   
   if (vm.count("help")) {
     PrintVersion(cerr);
@@ -135,7 +153,21 @@ int main(int argc, char **argv)
     DoCipher = true;
   }
   
+  if (vm.count("seed")) {
+    gen.seed(Seed);
+  }
+  
+  if (vm.count("drumCatalog")) {
+    try {
+      M209::LoadDrumCatalog(DrumCatalogFile);
+    } catch (std::runtime_error& e) {
+      cerr << "ERROR: " << e.what() << endl;
+      exit(1);
+    }
+  }
+  
   if (vm.count("-g")) {
+    m209.SetSearchJobs(Jobs);
     m209.GenKey1944();
   }
   
@@ -146,6 +178,13 @@ int main(int argc, char **argv)
       cerr << desc << endl;
       exit(1);
     }
+    // Checked here rather than when each message loads its key, so that a
+    // batch doesn't start only to have every message fail.
+    if (getenv("M209_KEYLIST_DIR") == nullptr) {
+      cerr << "ERROR: Environmental variable M209_KEYLIST_DIR must be defined to";
+      cerr << " use the -A mode." << endl;
+      exit(1);
+    }
     if ((vm.count("-c") || vm.count("-p")) && NetIndicator.size()==0) {
       NetIndicator = "M209GROUP";
     }
@@ -162,21 +201,26 @@ int main(int argc, char **argv)
       exit(1);
     }
   }
+  if (vm.count("seek") && AutoMsgIndicator) {
+    cerr << "ERROR: --seek can only be used with -i" << endl;
+    cerr << desc << endl;
+    exit(1);
+  }
   if (DoCipher && (vm.count("-i")+AutoMsgIndicator !=1 )){
     cerr << "ERROR: Either -i or autoMsg must be specified but not booth" << endl;
     cerr << desc << endl;
     exit(1);
   }
   if (vm.count("-i")) {
-    if (indicator.size() != NUM_WHEELS) {
+    if (indicator.size() != M209::NUM_WHEELS) {
       cerr << "ERROR: -i requires "
-      << dec << NUM_WHEELS
+      << dec << M209::NUM_WHEELS
       << " arguments."
       << endl;
       cerr << desc << endl;
       exit(1);
     }
-    for (i=0; i<NUM_WHEELS; i++) {
+    for (i=0; i<M209::NUM_WHEELS; i++) {
       
       if (indicator[i].size() != 1 || !isalpha(indicator[i][0])) {
         cerr << "ERROR: -i requires single-letter alphabetic arguments"
@@ -244,48 +288,102 @@ int main(int argc, char **argv)
     m209.PrintKey(KeyListIndicator, NetIndicator, out);
   }
   
+  if (vm.count("binaryKey")) {
+    if (AutoKey && !vm.count("-p")) {
+      date now = day_clock::universal_day();
+      if (!m209.LoadKey(now, KeyListIndicator, NetIndicator)) {
+        cerr << "ERROR: Unable to load key from data base" << endl;
+        exit(1);
+      }
+    }
+    if (!m209.SaveBinaryKey(BinaryKeyFile, KeyListIndicator, NetIndicator)) {
+      cerr << "m209: Unable to write binary key file " << BinaryKeyFile << endl;
+      exit(1);
+    }
+  }
+  
   if (Verbose) {
-    cerr << "Using "
-    << "std::random_device"
-    << " for random number generation."
-    << endl;
+    cerr << "Using ChaChaRandom ";
+    if (vm.count("seed")) {
+      cerr << "seeded with " << Seed;
+    } else {
+      cerr << "keyed from std::random_device";
+    }
+    cerr << " for random number generation." << endl;
   }
 
   if (DoCipher) {
-    if (!AutoMsgIndicator) {
-      if (!m209.SetWheels(indicator)) {
-        cerr << "ERROR: Invalid wheel position(s) specified"
-        << endl;
-        exit(1);
-      }
-    }
-    
     if (!Quiet) {
       cerr << "Reading from stdin..." << endl;
     }
     
-    if (SkipChars > 0) {
-      if (!Quiet) {
-        cerr << "(Skipping first " << SkipChars << " characters)" << endl;
+    // Encipher or decipher message n. Each message of a batch starts from
+    // the indicators given on the command line and, if a seed is given,
+    // from its own stream of the seed, so that its output doesn't depend
+    // on the number of jobs.
+    auto CipherMessage = [&](M209& machine, size_t n, istream& is,
+                             ostream& os) {
+      const Context& context = machine.GetContext();
+      if (Batch && vm.count("seed")) {
+        gen.seed(Seed, n);
       }
-      char c;
-      for (int n = 0; n< SkipChars; ) {
-        if (!in.good()) {
-          break;
+      string MsgKeyListIndicator = KeyListIndicator;
+      string MsgNetIndicator = NetIndicator;
+      if (!AutoMsgIndicator) {
+        if (!machine.SetWheels(indicator)) {
+          throw std::runtime_error("Invalid wheel position(s) specified");
+        }
+        machine.Seek(SeekLetter);
+      }
+      
+      if (SkipChars > 0) {
+        if (!context.Quiet) {
+          *context.Log << "(Skipping first " << SkipChars << " characters)"
+                       << endl;
         }
-        c = in.get();
-        if (!isspace(c)) {
-          ++n;
+        char c;
+        for (int n = 0; n< SkipChars; ) {
+          if (!is.good()) {
+            break;
+          }
+          c = is.get();
+          if (!isspace(c)) {
+            ++n;
+          }
         }
       }
+      
+      machine.CipherStream(AutoKey,
+                        AutoMsgIndicator,
+                        MsgKeyListIndicator,
+                        MsgNetIndicator,
+                        KeyDir, CipherMode, is, os, Streaming);
+    };
+    
+    if (Batch) {
+      // Messages are separated by BATCH_SEPARATOR lines, and so are their
+      // outputs. A message that fails leaves its output empty.
+      size_t count = 0;
+      size_t failed = CipherBatch<M209>(m209, Jobs, in, out, CipherMessage,
+                                       count);
+      if (!Quiet) {
+        cerr << count << " messages, " << failed << " failed" << endl;
+      }
+      Failed = failed > 0;
+    } else {
+      try {
+        CipherMessage(m209, 1, in, out);
+      } catch (std::runtime_error& e) {
+        cerr << "ERROR: " << e.what() << endl;
+        exit(1);
+      }
     }
-   
-    m209.CipherStream(AutoKey,
-                      AutoMsgIndicator,
-                      KeyListIndicator,
-                      NetIndicator,
-                      KeyDir, CipherMode, in, out);
   }
   
-  return 0;
+  if (Verbose) {
+    cerr << "Key cache: " << M209::KeyListCache.hits() << " hits, "
+         << M209::KeyListCache.misses() << " misses" << endl;
+  }
+  
+  return Failed ? 1 : 0;
 }
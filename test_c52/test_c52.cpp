@@ -34,6 +34,8 @@ using std::endl;
 using std::ifstream;
 #include <sstream>
 using std::stringstream;
+#include <cstdio>
+#include <climits>
 #define BOOST_TEST_MODULE test_c52
 #include <boost/test/included/unit_test.hpp>
 #include <boost/test/data/test_case.hpp>
@@ -41,6 +43,7 @@ using std::stringstream;
 #define SOURCE
 #include "config.h"
 #include "C52.hpp"
+#include "DrumCatalog.h"
 
 //! If true, enable verbose debugging messages to stderr.
 //
@@ -262,3 +265,385 @@ BOOST_AUTO_TEST_CASE(cx52_auto_key_test){
   BOOST_TEST(f_okay);
 }
 
+
+BOOST_AUTO_TEST_CASE(cipher_buffer_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52, c52_scalar;
+  date d = date_from_iso_string("20191015");
+  string fname = src_dir + "/tests/20191015.c52key";
+  string NetIndicator = "";
+  c52.LoadKey(fname, NetIndicator, d);
+  c52_scalar.LoadKey(fname, NetIndicator, d);
+  vector<string> initial_pos{"D","K","A","P","B","Q"};
+  BOOST_TEST(c52.SetWheels(initial_pos));
+  BOOST_TEST(c52_scalar.SetWheels(initial_pos));
+  c52.SetPrintOffset(17);
+  c52_scalar.SetPrintOffset(17);
+  // Odd length so that the vector kernels also handle a tail.
+  string in(1001, 'A');
+  for (size_t i=0; i<in.size(); ++i)
+    in[i] = 'A' + (i * 7 + i / 26) % 26;
+  string out(in.size(), ' ');
+  c52.CipherBuffer(&in[0], in.size(), &out[0]);
+  bool f_okay = true;
+  for (size_t i=0; i<in.size(); ++i) {
+    if (out[i] != c52_scalar.Cipher(in[i]))
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+  // The wheels must end up where the scalar path leaves them.
+  BOOST_TEST(c52.Cipher('A') == c52_scalar.Cipher('A'));
+}
+
+BOOST_AUTO_TEST_CASE(seed_test){
+  C52 c52;
+  date d = date_from_iso_string("20191015");
+  string NetIndicator = "TEST";
+  stringstream key1, key2;
+  gen.seed(1952);
+  c52.GenKey();
+  c52.PrintKey(NetIndicator, d, key1);
+  gen.seed(1952);
+  c52.GenKey();
+  c52.PrintKey(NetIndicator, d, key2);
+  BOOST_TEST(key1.str() == key2.str());
+  
+  // The same for any number of drum searches at once
+  stringstream key4;
+  c52.SetSearchJobs(4);
+  gen.seed(1952);
+  c52.GenKey();
+  c52.PrintKey(NetIndicator, d, key4);
+  BOOST_TEST(key1.str() == key4.str());
+}
+
+BOOST_AUTO_TEST_CASE(drum_cache_test){
+  C52 c52;
+  C52::DrumSearchCache.clear();
+  array<int, C52::NUM_WHEELS> NumArray{{1, 2, 4, 6, 9, 11}};
+  array<int, C52::NUM_WHEELS> Shuffled{{9, 1, 11, 4, 6, 2}};
+  int tries;
+  vector<C52::ScoredDrum> drums = c52.GoodDrums(Shuffled, tries);
+  BOOST_TEST(drums.size() > 0);
+  BOOST_TEST(C52::DrumSearchCache.size() == 1);
+  
+  // The cached result matches a fresh search, drum for drum. The number
+  // of branches visited is that of the search of the sorted NumArray.
+  DrumCache::Entry fresh = c52.SearchDrums(Shuffled);
+  BOOST_TEST(drums.size() == fresh.overlaps.size());
+  fresh = c52.SearchDrums(NumArray);
+  BOOST_TEST(tries == fresh.tries);
+  
+  // Any permutation is served from the same entry.
+  c52.GoodDrums(NumArray, tries);
+  BOOST_TEST(C52::DrumSearchCache.size() == 1);
+  BOOST_TEST(tries == fresh.tries);
+}
+
+BOOST_AUTO_TEST_CASE(drum_catalog_test){
+  C52 c52;
+  array<int, C52::NUM_WHEELS> NumArray{{1, 2, 4, 6, 9, 11}};
+  DrumCache::Entry fresh = c52.SearchDrums(NumArray);
+  map<DrumCache::NumArrayType, vector<DrumCache::Overlaps> > drums;
+  drums[NumArray] = fresh.overlaps;
+  string fname = "drum_catalog_test_c52.bin";
+  BOOST_TEST(DrumCatalog::Write(fname, drums));
+  
+  // Every catalog drum is a valid set of cipher bars.
+  DrumCatalog catalog(fname);
+  const DrumCatalog::Entry* entry = catalog.Find(NumArray);
+  BOOST_REQUIRE(entry);
+  BOOST_TEST(entry->count == fresh.overlaps.size());
+  bool f_okay = true;
+  for (size_t n=0; n<entry->count; ++n) {
+    DrumCatalog::Bars bars = catalog.Drum(*entry, n);
+    C52::DrumType drum;
+    for (int b=0; b<DrumCatalog::CIPHER_BARS; ++b)
+      drum[C52::NUM_WHEELS-1+b] = bitset<C52::NUM_WHEELS>(bars[b]);
+    f_okay &= c52.ValidateDrum(drum);
+  }
+  BOOST_TEST(f_okay);
+  
+  C52::LoadDrumCatalog(fname);
+  for (int i=0; i<5; ++i) {
+    c52.GenKey();
+    BOOST_TEST(c52.ValidateDrum(c52.getDrum()));
+  }
+  std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(stream_test){
+  // A message of several chunks, in and out of streaming mode
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52;
+  bool AutoKey = false;
+  bool AutoMsgIndicator = true;
+  date d = date_from_iso_string("20191015");
+  string NetIndicator = "TEST";
+  string KeyDir = src_dir + "/tests";
+  string plain;
+  for (int i=0; i<3000; ++i)
+    plain += "HELLO WORLD ATTACK AT DAWN ON THE EASTERN RIDGE\n";
+  
+  stringstream plain_text(plain), cipher_text;
+  gen.seed(52);
+  c52.CipherStream(AutoKey, AutoMsgIndicator, d, NetIndicator,
+                   KeyDir, true, plain_text, cipher_text);
+  stringstream plain_text2(plain), streamed;
+  gen.seed(52);
+  c52.CipherStream(AutoKey, AutoMsgIndicator, d, NetIndicator,
+                   KeyDir, true, plain_text2, streamed, true);
+  // Only the net indicator line is left out
+  string cipher = cipher_text.str();
+  BOOST_TEST(cipher.substr(0, 5) == "TEST ");
+  BOOST_TEST(streamed.str() == cipher.substr(cipher.find('\n')+1));
+  
+  stringstream cipher_text2(cipher), deciphered, deciphered_streamed;
+  c52.CipherStream(AutoKey, AutoMsgIndicator, d, NetIndicator,
+                   KeyDir, false, cipher_text, deciphered);
+  c52.CipherStream(AutoKey, AutoMsgIndicator, d, NetIndicator,
+                   KeyDir, false, cipher_text2, deciphered_streamed, true);
+  BOOST_TEST(deciphered.str() == deciphered_streamed.str());
+  
+  plain_text.clear();
+  plain_text.seekg(0);
+  bool f_okay = true;
+  char c1;
+  while (plain_text >> c1) {
+    char c2;
+    deciphered_streamed >> c2;
+    if (c1 != c2)
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+}
+
+BOOST_AUTO_TEST_CASE(binary_key_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52, c52_bin;
+  date d = date_from_iso_string("20191015");
+  string NetIndicator = "C52NET";
+  BOOST_TEST(c52.LoadKey(src_dir + "/tests/20191015.c52key", NetIndicator, d));
+  string fname = "binary_key_test.c52bin";
+  BOOST_TEST(c52.SaveBinaryKey(fname, NetIndicator, d));
+  
+  string NetIndicator2;
+  date d2;
+  BOOST_TEST(c52_bin.LoadBinaryKey(fname, NetIndicator2, d2));
+  BOOST_TEST(NetIndicator2 == NetIndicator);
+  BOOST_TEST(d2 == d);
+  stringstream key, key_bin;
+  c52.PrintKey(NetIndicator, d, key);
+  c52_bin.PrintKey(NetIndicator2, d2, key_bin);
+  BOOST_TEST(key.str() == key_bin.str());
+  
+  // LoadKey reads a file by its suffix
+  C52 c52_load;
+  BOOST_TEST(c52_load.LoadKey(fname, NetIndicator2, d2));
+  BOOST_TEST(c52_load.GetKeyRecord(NetIndicator, d).lugs[10]
+             == c52.GetKeyRecord(NetIndicator, d).lugs[10]);
+  BOOST_TEST(!c52_load.LoadBinaryKey("no_such_key.c52bin", NetIndicator2, d2));
+  BOOST_CHECK_THROW(C52().LoadBinaryKey(src_dir + "/tests/20191015.c52key",
+                                        NetIndicator2, d2),
+                    std::runtime_error);
+  std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(key_database_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52;
+  date d = date_from_iso_string("20191015");
+  date d2 = d + days(3);
+  string NetIndicator = "DBTEST";
+  BOOST_TEST(c52.LoadKey(src_dir + "/tests/20191015.c52key", NetIndicator, d));
+  vector<KeyRecord> records{c52.GetKeyRecord(NetIndicator, d)};
+  stringstream key, key2;
+  c52.PrintKey(NetIndicator, d, key);
+  gen.seed(52);
+  c52.GenKey();
+  records.push_back(c52.GetKeyRecord(NetIndicator, d2));
+  c52.PrintKey(NetIndicator, d2, key2);
+  string fname = NetIndicator + C52::KEYDB_SUFFIX;
+  BOOST_TEST(KeyDataBase::Write(fname, records));
+  
+  {
+    KeyDataBase db(fname);
+    BOOST_TEST(db.size() == 4u);
+    BOOST_TEST(db.FirstDay() == d.day_number());
+    BOOST_TEST(db.Find(d.day_number()));
+    BOOST_TEST(!db.Find(d.day_number()+1));
+    BOOST_TEST(!db.Find(d.day_number()-1));
+    BOOST_TEST(!db.Find(d2.day_number()+1));
+  }
+  
+  // LoadKey(date) takes the key from the data base of the net
+  const char* dir = getenv("C52_KEYLIST_DIR");
+  string saved_dir = dir ? dir : "";
+  setenv("C52_KEYLIST_DIR", ".", 1);
+  C52 c52_db;
+  stringstream key_db, key2_db;
+  BOOST_TEST(c52_db.LoadKey(d, NetIndicator));
+  c52_db.PrintKey(NetIndicator, d, key_db);
+  BOOST_TEST(c52_db.LoadKey(d2, NetIndicator));
+  c52_db.PrintKey(NetIndicator, d2, key2_db);
+  BOOST_TEST(!c52_db.LoadKey(d + days(1), NetIndicator));
+  // A second load of a key comes from the cache, even if the data base
+  // is gone.
+  std::remove(fname.c_str());
+  size_t hits = C52::KeyListCache.hits();
+  C52 c52_cached;
+  stringstream key_cached;
+  BOOST_TEST(c52_cached.LoadKey(d, NetIndicator));
+  c52_cached.PrintKey(NetIndicator, d, key_cached);
+  BOOST_TEST(C52::KeyListCache.hits() == hits + 1);
+  BOOST_TEST(key_cached.str() == key.str());
+  if (dir)
+    setenv("C52_KEYLIST_DIR", saved_dir.c_str(), 1);
+  else
+    unsetenv("C52_KEYLIST_DIR");
+  BOOST_TEST(key_db.str() == key.str());
+  BOOST_TEST(key2_db.str() == key2.str());
+  
+  vector<KeyRecord> twice{records[0], records[0]};
+  BOOST_CHECK_THROW(KeyDataBase::Write(fname, twice), std::invalid_argument);
+  std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(group_count_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52;
+  date d = date_from_iso_string("20191015");
+  string NetIndicator = "";
+  c52.LoadKey(src_dir + "/tests/20191015.c52key", NetIndicator, d);
+  vector<string> initial_pos{"D","K","A","P","B","Q"};
+  BOOST_REQUIRE(c52.SetWheels(initial_pos));
+  c52.SetCheckpointInterval(1);
+  c52.StartCheckpoints();
+  C52::CheckpointTable start;
+  start.Positions.assign(2, c52.GetCheckpoints().Positions[0]);
+  c52.SetCheckpointInterval(0);
+  
+  // Encipher 60 letters from letter interval, seeking there through a
+  // checkpoint, and return the output with every letter replaced by '.',
+  // leaving the grouping
+  auto Groups = [&](uint64_t interval) {
+    start.Interval = interval;
+    c52.Seek(interval, start);
+    stringstream in(string(60, 'A')), out;
+    c52.CipherStream(false, false, d, NetIndicator, "", true, in, out, true);
+    string groups = out.str();
+    for (char& c : groups)
+      if (isalpha(c))
+        c = '.';
+    return groups;
+  };
+  
+  // Grouping past letter INT_MAX is that of a short message at the same
+  // place in a line
+  uint64_t interval = INT_MAX - 7;
+  string far = Groups(interval);
+  BOOST_TEST(far == Groups(interval % 25));
+  BOOST_TEST(far.find("......") == string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(checkpoint_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52, c52_seek;
+  date d = date_from_iso_string("20191015");
+  string fname = src_dir + "/tests/20191015.c52key";
+  string NetIndicator = "";
+  c52.LoadKey(fname, NetIndicator, d);
+  c52_seek.LoadKey(fname, NetIndicator, d);
+  vector<string> initial_pos{"D","K","A","P","B","Q"};
+  BOOST_TEST(c52.SetWheels(initial_pos));
+  c52.SetPrintOffset(17);
+  c52.SetCheckpointInterval(100);
+  c52.StartCheckpoints();
+  string in(1001, 'A');
+  for (size_t i=0; i<in.size(); ++i)
+    in[i] = 'A' + (i * 7 + i / 26) % 26;
+  string out(in.size(), ' ');
+  c52.CipherBuffer(&in[0], in.size(), &out[0]);
+  BOOST_TEST(c52.GetCheckpoints().Positions.size() == 11u);
+  
+  // Write and read the table back
+  stringstream table;
+  c52.GetCheckpoints().Write(table);
+  C52::CheckpointTable checkpoints;
+  checkpoints.Read(table);
+  BOOST_TEST(checkpoints.Interval == 100u);
+  BOOST_TEST(checkpoints.PrintOffset == 17);
+  BOOST_TEST(checkpoints.Positions == c52.GetCheckpoints().Positions);
+  
+  // Deciphering from any letter matches the rest of the message
+  for (uint64_t n : {0, 1, 99, 100, 457, 1000}) {
+    c52_seek.Seek(n, checkpoints);
+    string tail(in.size() - n, ' ');
+    c52_seek.CipherBuffer(&out[n], tail.size(), &tail[0]);
+    BOOST_TEST(tail == in.substr(n));
+  }
+  
+  // Fast forward from the start of the message gets to the same place
+  BOOST_TEST(c52_seek.SetWheels(initial_pos));
+  c52_seek.SetPrintOffset(17);
+  c52_seek.FastForward(457);
+  string tail(in.size() - 457, ' ');
+  c52_seek.CipherBuffer(&out[457], tail.size(), &tail[0]);
+  BOOST_TEST(tail == in.substr(457));
+  
+  // Letter indices past the range of an int seek from their checkpoint
+  C52::CheckpointTable far;
+  far.Interval = uint64_t(1) << 32;
+  far.PrintOffset = 17;
+  far.Positions.assign(2, checkpoints.Positions[0]);
+  c52_seek.Seek(far.Interval + 457, far);
+  c52_seek.CipherBuffer(&out[457], tail.size(), &tail[0]);
+  BOOST_TEST(tail == in.substr(457));
+  
+  stringstream bad("C52CHECKPOINTS 100 17 2\n0 1 2 3 4 5 6\n99 1 2 3 4 5 6\n");
+  BOOST_CHECK_THROW(checkpoints.Read(bad), std::runtime_error);
+  BOOST_CHECK_THROW(c52_seek.Seek(5, C52::CheckpointTable()),
+                    std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(cx52_engine_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  C52 c52;
+  date d = date_from_iso_string("20191015");
+  string NetIndicator = "";
+  c52.LoadKey(src_dir + "/tests/20191015.c52key", NetIndicator, d);
+  
+  // The drum of the key on six of the 47 position CX-52 wheels
+  KeyRecord record = c52.GetKeyRecord(NetIndicator, d);
+  for (size_t i=0; i<C52::NUM_WHEELS; i++) {
+    record.wheel_idx[i] = 11;
+    record.pins[i] = 0x5a3c96e1f00dULL * (i + 3);
+  }
+  C52 cx52, cx52_scalar;
+  cx52.SetKeyRecord(record);
+  cx52_scalar.SetKeyRecord(record);
+  vector<string> initial_pos{"D","K","A","P","B","Q"};
+  BOOST_TEST(cx52.SetWheels(initial_pos));
+  BOOST_TEST(cx52_scalar.SetWheels(initial_pos));
+  cx52.SetPrintOffset(5);
+  cx52_scalar.SetPrintOffset(5);
+  string in(3001, 'A');
+  for (size_t i=0; i<in.size(); ++i)
+    in[i] = 'A' + (i * 7 + i / 26) % 26;
+  string out(in.size(), ' ');
+  cx52.CipherBuffer(&in[0], in.size(), &out[0]);
+  bool f_okay = true;
+  for (size_t i=0; i<in.size(); ++i) {
+    if (out[i] != cx52_scalar.Cipher(in[i]))
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+  BOOST_TEST(cx52.Cipher('A') == cx52_scalar.Cipher('A'));
+  
+  // Fast forward takes the CX-52 path too
+  BOOST_TEST(cx52.SetWheels(initial_pos));
+  cx52.FastForward(1500);
+  string tail(in.size() - 1500, ' ');
+  cx52.CipherBuffer(&out[1500], tail.size(), &tail[0]);
+  BOOST_TEST(tail == in.substr(1500));
+}
@@ -34,6 +34,11 @@ using std::endl;
 using std::ifstream;
 #include <sstream>
 using std::stringstream;
+using std::istringstream;
+#include <cstdio>
+#include <climits>
+#include <set>
+using std::set;
 #define BOOST_TEST_MODULE test_m209
 #include <boost/test/included/unit_test.hpp>
 #include <boost/test/data/test_case.hpp>
@@ -41,6 +46,15 @@ using std::stringstream;
 #define SOURCE
 #include "config.h"
 #include "M209.h"
+#include "CipherKernel.h"
+#include "LetterReader.h"
+#include "Batch.h"
+#include "DrumCatalog.h"
+#include "SumCoverage.h"
+#include "PinSampler.h"
+#include "TopReservoir.h"
+#include "FirstSuccess.h"
+#include "KeyListDataBase.hpp"
 
 //! If true, enable verbose debugging messages to stderr.
 //
@@ -246,3 +260,724 @@ BOOST_AUTO_TEST_CASE(auto_key_test){
   BOOST_TEST(f_okay);
 }
 
+
+BOOST_AUTO_TEST_CASE(keystream_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209;
+  string KeyListIndicator = "";
+  string NetIndicator = "";
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key",
+                          KeyListIndicator, NetIndicator));
+  array<int, M209::NUM_WHEELS> start{{3, 23, 0, 20, 11, 16}};
+  vector<string> initial_pos{"D","Y","A","U","L","Q"};
+  vector<unsigned char> key = m209.Keystream(start, 1000);
+  m209.SetWheels(initial_pos);
+  bool f_okay = true;
+  for (size_t i=0; i<key.size(); ++i) {
+    char c = 'A' + i % 26;
+    int cnum = (c - 'A' - key[i] + 52) % 26;
+    if (m209.Cipher(c) != 'Z' - cnum)
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+}
+
+BOOST_AUTO_TEST_CASE(cipher_buffer_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209, m209_scalar;
+  string KeyListIndicator = "";
+  string NetIndicator = "";
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key",
+                          KeyListIndicator, NetIndicator));
+  BOOST_TEST(m209_scalar.LoadKey(src_dir + "/tests/MB.m209key",
+                                 KeyListIndicator, NetIndicator));
+  vector<string> initial_pos{"D","Y","A","U","L","Q"};
+  m209.SetWheels(initial_pos);
+  m209_scalar.SetWheels(initial_pos);
+  // Odd length so that the vector kernels also handle a tail.
+  string in(1001, 'A');
+  for (size_t i=0; i<in.size(); ++i)
+    in[i] = 'A' + (i * 7 + i / 26) % 26;
+  string out(in.size(), ' ');
+  m209.CipherBuffer(&in[0], in.size(), &out[0]);
+  bool f_okay = true;
+  for (size_t i=0; i<in.size(); ++i) {
+    if (out[i] != m209_scalar.Cipher(in[i]))
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+  // The wheels must end up where the scalar path leaves them.
+  BOOST_TEST(m209.Cipher('A') == m209_scalar.Cipher('A'));
+}
+
+BOOST_AUTO_TEST_CASE(cipher_kernel_test){
+  string in(1001, 'A');
+  vector<unsigned char> key(in.size());
+  for (size_t i=0; i<in.size(); ++i) {
+    in[i] = 'A' + i % 26;
+    key[i] = (i / 26) % (CipherKernel::MAX_KEY + 1);
+  }
+  string expected(in.size(), ' ');
+  CipherKernel::Apply(CipherKernel::SCALAR, &in[0], &key[0], in.size(),
+                      &expected[0]);
+  bool f_okay = true;
+  for (size_t i=0; i<in.size(); ++i) {
+    if (expected[i] != 'Z' - (in[i] - 'A' + key[i]) % 26)
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+  CipherKernel::Isa isas[] = {CipherKernel::SSE2, CipherKernel::AVX2};
+  for (CipherKernel::Isa isa : isas) {
+    if (!CipherKernel::Supported(isa))
+      continue;
+    string out(in.size(), ' ');
+    CipherKernel::Apply(isa, &in[0], &key[0], in.size(), &out[0]);
+    BOOST_TEST(out == expected, CipherKernel::Name(isa));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(random_test){
+  // ChaCha20 keystream for an all zero key and nonce.
+  ChaChaRandom rng(0);
+  BOOST_TEST(rng() == 0xade0b876u);
+  BOOST_TEST(rng() == 0x903df1a0u);
+  BOOST_TEST(rng() == 0xe56a5d40u);
+  BOOST_TEST(rng() == 0x28bd8653u);
+  
+  // The same seed must give the same key.
+  M209 m209;
+  string KeyListIndicator = "";
+  string NetIndicator = "";
+  stringstream key1, key2;
+  gen.seed(1944);
+  m209.GenKey1944();
+  m209.PrintKey(KeyListIndicator, NetIndicator, key1);
+  gen.seed(1944);
+  m209.GenKey1944();
+  m209.PrintKey(KeyListIndicator, NetIndicator, key2);
+  BOOST_TEST(key1.str() == key2.str());
+}
+
+BOOST_AUTO_TEST_CASE(drum_cache_test){
+  M209 m209;
+  M209::DrumSearchCache.clear();
+  array<int, M209::NUM_WHEELS> NumArray{{1, 2, 4, 6, 9, 11}};
+  array<int, M209::NUM_WHEELS> Shuffled{{9, 1, 11, 4, 6, 2}};
+  int tries, shuffled_tries;
+  vector<M209::ScoredDrum> drums = m209.GoodDrums(NumArray, tries);
+  BOOST_TEST(drums.size() > 0);
+  BOOST_TEST(M209::DrumSearchCache.size() == 1);
+  
+  // A permutation is served from the cache in the order of a fresh search.
+  DrumCache::Entry fresh = m209.SearchDrums(Shuffled);
+  vector<DrumCache::Overlaps> cached =
+    M209::DrumSearchCache.Lookup(Shuffled, shuffled_tries,
+                                 [](const DrumCache::NumArrayType&) {
+                                   BOOST_TEST(false);
+                                   return DrumCache::Entry();
+                                 });
+  BOOST_TEST(M209::DrumSearchCache.size() == 1);
+  BOOST_TEST(shuffled_tries == tries);
+  BOOST_TEST((cached == fresh.overlaps));
+  
+  // The cache survives a round trip through a file.
+  stringstream saved;
+  M209::DrumSearchCache.Save(saved);
+  M209::DrumSearchCache.clear();
+  M209::DrumSearchCache.Load(saved);
+  BOOST_TEST(M209::DrumSearchCache.size() == 1);
+  vector<M209::ScoredDrum> loaded = m209.GoodDrums(NumArray, tries);
+  BOOST_TEST(loaded.size() == drums.size());
+  bool f_okay = true;
+  for (size_t i=0; i<loaded.size() && i<drums.size(); ++i) {
+    if (loaded[i].drum != drums[i].drum || loaded[i].score != drums[i].score)
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+}
+
+BOOST_AUTO_TEST_CASE(drum_catalog_test){
+  M209 m209;
+  array<int, M209::NUM_WHEELS> NumArray{{1, 2, 4, 6, 9, 11}};
+  DrumCache::Entry fresh = m209.SearchDrums(NumArray);
+  map<DrumCache::NumArrayType, vector<DrumCache::Overlaps> > drums;
+  drums[NumArray] = fresh.overlaps;
+  string fname = "drum_catalog_test.bin";
+  BOOST_TEST(DrumCatalog::Write(fname, drums));
+  
+  DrumCatalog catalog(fname);
+  BOOST_TEST(catalog.size() == 1);
+  array<int, M209::NUM_WHEELS> Missing{{1, 2, 3, 6, 9, 11}};
+  BOOST_TEST(!catalog.Find(Missing));
+  const DrumCatalog::Entry* entry = catalog.Find(NumArray);
+  BOOST_REQUIRE(entry);
+  BOOST_TEST(entry->count == fresh.overlaps.size());
+  BOOST_TEST(entry->candidates > 0);
+  BOOST_TEST(entry->candidates <= entry->count);
+  
+  // Every drum unpacks to a valid drum with the right lugs.
+  bool f_okay = true;
+  for (size_t n=0; n<entry->count; ++n) {
+    DrumCatalog::Bars bars = catalog.Drum(*entry, n);
+    M209::DrumType drum;
+    for (int b=0; b<M209::NUM_LUG_BARS; ++b)
+      drum[b] = bitset<M209::NUM_WHEELS>(bars[b]);
+    for (int i=0; i<M209::NUM_WHEELS; ++i) {
+      int sum = 0;
+      for (auto& bar : drum)
+        sum += bar[i];
+      f_okay &= sum == NumArray[i];
+    }
+    f_okay &= m209.ValidateDrum(drum);
+  }
+  BOOST_TEST(f_okay);
+  
+  // GenKey1944 uses the catalog and searches for NumArrays not in it.
+  M209::LoadDrumCatalog(fname);
+  for (int i=0; i<5; ++i) {
+    m209.GenKey1944();
+    BOOST_TEST(m209.ValidateDrum(m209.getDrum()));
+  }
+  BOOST_CHECK_THROW(M209::LoadDrumCatalog("test_m209.cpp"), std::runtime_error);
+  std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(validate_drum_test){
+  // Compare with a direct count over all 64 pin patterns, on good drums
+  // and on the same drums with one lug moved.
+  M209 m209;
+  array<int, M209::NUM_WHEELS> NumArray{{1, 2, 4, 6, 9, 11}};
+  int tries;
+  vector<M209::ScoredDrum> good = m209.GoodDrums(NumArray, tries);
+  ChaChaRandom rng(209);
+  uniform_int_distribution<int> dist_bar(0, M209::NUM_LUG_BARS-1);
+  uniform_int_distribution<int> dist_wheel(0, M209::NUM_WHEELS-1);
+  int num_valid = 0, num_invalid = 0;
+  bool f_okay = true;
+  for (auto& scored : good) {
+    for (int n=0; n<2; ++n) {
+      M209::DrumType drum = scored.drum;
+      if (n) {
+        drum[dist_bar(rng)].reset();
+        drum[dist_bar(rng)][dist_wheel(rng)] = 1;
+      }
+      bitset<M209::NUM_LUG_BARS+1> Sums(0);
+      for (int p=0; p<(1 << M209::NUM_WHEELS); ++p) {
+        int sum = 0;
+        for (auto& bar : drum)
+          sum += (bar & bitset<M209::NUM_WHEELS>(p)).any();
+        Sums[sum] = 1;
+      }
+      num_valid += Sums.all();
+      num_invalid += !Sums.all();
+      f_okay &= m209.ValidateDrum(drum) == Sums.all();
+    }
+  }
+  BOOST_TEST(f_okay);
+  BOOST_TEST(num_valid > 0);
+  BOOST_TEST(num_invalid > 0);
+}
+
+BOOST_AUTO_TEST_CASE(partial_sums_test){
+  // No prefix of a good drum's overlaps may be pruned, and the complete
+  // overlaps must pass exactly when ValidateDrum does.
+  M209 m209;
+  array<int, M209::NUM_WHEELS> NumArray{{1, 2, 4, 6, 9, 11}};
+  DrumCache::Entry found = m209.SearchDrums(NumArray);
+  BOOST_TEST(found.overlaps.size() > 0);
+  BOOST_TEST(found.tries > 0);
+  const int PAIRS = PartialSums<M209::NUM_WHEELS>::PAIRS;
+  int total = accumulate(NumArray.begin(), NumArray.end(), 0) - M209::NUM_LUG_BARS;
+  bool f_okay = true;
+  for (auto& o : found.overlaps) {
+    PartialSums<M209::NUM_WHEELS> sums(NumArray, M209::NUM_LUG_BARS);
+    int remaining = total;
+    for (int l=0; l<PAIRS; ++l) {
+      sums.Add(l, o[l]);
+      remaining -= o[l];
+      f_okay &= sums.CanCover(l, remaining, 4);
+    }
+  }
+  BOOST_TEST(f_okay);
+  // Keys 6 to 21 can't be made when one wheel has 22 lugs
+  array<int, M209::NUM_WHEELS> Lopsided{{1, 1, 1, 1, 1, 22}};
+  PartialSums<M209::NUM_WHEELS> sums(Lopsided, M209::NUM_LUG_BARS);
+  BOOST_TEST(!sums.CanCover(0, 0, 4));
+  BOOST_TEST(m209.SearchDrums(Lopsided).overlaps.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(stream_test){
+  // A message of several chunks, in and out of streaming mode
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209;
+  bool AutoKey = false;
+  bool AutoMsgIndicator = true;
+  string KeyListIndicator = "MB";
+  string NetIndicator = "TEST";
+  string KeyDir = src_dir + "/tests";
+  string plain;
+  for (int i=0; i<3000; ++i)
+    plain += "HELLO WORLD ATTACK AT DAWN ON THE EASTERN RIDGE\n";
+  
+  stringstream plain_text(plain), cipher_text;
+  gen.seed(209);
+  m209.CipherStream(AutoKey, AutoMsgIndicator, KeyListIndicator, NetIndicator,
+                    KeyDir, true, plain_text, cipher_text);
+  stringstream plain_text2(plain), streamed;
+  gen.seed(209);
+  m209.CipherStream(AutoKey, AutoMsgIndicator, KeyListIndicator, NetIndicator,
+                    KeyDir, true, plain_text2, streamed, true);
+  // Only the net indicator line is left out
+  string cipher = cipher_text.str();
+  BOOST_TEST(cipher.substr(0, 8) == "TEST GR ");
+  BOOST_TEST(streamed.str() == cipher.substr(cipher.find('\n')+1));
+  
+  stringstream cipher_text2(cipher), deciphered, deciphered_streamed;
+  m209.CipherStream(AutoKey, AutoMsgIndicator, KeyListIndicator, NetIndicator,
+                    KeyDir, false, cipher_text, deciphered);
+  m209.CipherStream(AutoKey, AutoMsgIndicator, KeyListIndicator, NetIndicator,
+                    KeyDir, false, cipher_text2, deciphered_streamed, true);
+  BOOST_TEST(deciphered.str() == deciphered_streamed.str());
+  
+  plain_text.clear();
+  plain_text.seekg(0);
+  bool f_okay = true;
+  char c1;
+  while (plain_text >> c1) {
+    char c2;
+    deciphered_streamed >> c2;
+    if (c1 != c2)
+      f_okay = false;
+  }
+  BOOST_TEST(f_okay);
+}
+
+BOOST_AUTO_TEST_CASE(binary_key_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209, m209_bin;
+  string KeyListIndicator, NetIndicator;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key", KeyListIndicator,
+                          NetIndicator));
+  string fname = "binary_key_test.m209bin";
+  BOOST_TEST(m209.SaveBinaryKey(fname, KeyListIndicator, NetIndicator));
+  
+  string KeyListIndicator2, NetIndicator2;
+  BOOST_TEST(m209_bin.LoadKey(fname, KeyListIndicator2, NetIndicator2));
+  BOOST_TEST(KeyListIndicator2 == KeyListIndicator);
+  BOOST_TEST(NetIndicator2 == NetIndicator);
+  stringstream key, key_bin;
+  m209.PrintKey(KeyListIndicator, NetIndicator, key);
+  m209_bin.PrintKey(KeyListIndicator2, NetIndicator2, key_bin);
+  BOOST_TEST(key.str() == key_bin.str());
+  
+  BOOST_TEST(!m209_bin.LoadBinaryKey("no_such_key.m209bin", KeyListIndicator2,
+                                     NetIndicator2));
+  KeyRecord record = m209.GetKeyRecord(KeyListIndicator, NetIndicator);
+  record.lugs[0] = 7;
+  BOOST_CHECK_THROW(m209_bin.SetKeyRecord(record), std::invalid_argument);
+  std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(key_database_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209;
+  date d(2019, 10, 15);
+  string KeyListIndicator, NetIndicator;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key", KeyListIndicator,
+                          NetIndicator));
+  NetIndicator = "DBTEST";
+  vector<KeyRecord> records{m209.GetKeyRecord(KeyListIndicator, NetIndicator)};
+  records.back().day = d.day_number();
+  stringstream key;
+  m209.PrintKey("", "", key);
+  string fname = NetIndicator + M209::KEYDB_SUFFIX;
+  BOOST_TEST(KeyDataBase::Write(fname, records));
+  
+  // LoadKey(date) takes the key from the data base of the net
+  const char* dir = getenv("M209_KEYLIST_DIR");
+  string saved_dir = dir ? dir : "";
+  setenv("M209_KEYLIST_DIR", ".", 1);
+  M209 m209_db;
+  stringstream key_db;
+  BOOST_TEST(m209_db.LoadKey(d, KeyListIndicator, NetIndicator));
+  BOOST_TEST(KeyListIndicator == Date2KeyListIndicator(NetIndicator, d));
+  m209_db.PrintKey("", "", key_db);
+  BOOST_TEST(!m209_db.LoadKey(d + days(1), KeyListIndicator, NetIndicator));
+  // without the directory LoadKey(date) throws rather than exiting
+  unsetenv("M209_KEYLIST_DIR");
+  BOOST_CHECK_THROW(m209_db.LoadKey(d, KeyListIndicator, NetIndicator),
+                    std::runtime_error);
+  if (dir)
+    setenv("M209_KEYLIST_DIR", saved_dir.c_str(), 1);
+  BOOST_TEST(key_db.str() == key.str());
+  std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(key_cache_test){
+  KeyCache<int> cache(2);
+  typedef KeyCache<int>::Key Key;
+  Key a{KeyRecord::M209, "/keys/", "NET", 1};
+  Key b{KeyRecord::M209, "/keys/", "NET", 2};
+  Key c{KeyRecord::M209, "/other/", "NET", 2};
+  int state = 0;
+  BOOST_TEST(!cache.Lookup(a, state));
+  cache.Insert(a, 10);
+  cache.Insert(b, 20);
+  BOOST_TEST(cache.Lookup(a, state));
+  BOOST_TEST(state == 10);
+  // b is now the least recently used key
+  cache.Insert(c, 30);
+  BOOST_TEST(cache.size() == 2u);
+  BOOST_TEST(!cache.Lookup(b, state));
+  BOOST_TEST(cache.Lookup(c, state));
+  BOOST_TEST(state == 30);
+  BOOST_TEST(cache.hits() == 2u);
+  BOOST_TEST(cache.misses() == 2u);
+  cache.SetCapacity(1);
+  BOOST_TEST(!cache.Lookup(a, state));
+  BOOST_TEST(cache.Lookup(c, state));
+}
+
+BOOST_AUTO_TEST_CASE(read_message_test){
+  istringstream in("FIRST\nMESSAGE\n%%\n  %%\r\nTHIRD %% NOT A SEPARATOR\n");
+  string message;
+  BOOST_TEST(ReadMessage(in, message));
+  BOOST_TEST(message == "FIRST\nMESSAGE\n");
+  BOOST_TEST(ReadMessage(in, message));
+  BOOST_TEST(message == "");
+  BOOST_TEST(ReadMessage(in, message));
+  BOOST_TEST(message == "THIRD %% NOT A SEPARATOR\n");
+  BOOST_TEST(!ReadMessage(in, message));
+  BOOST_TEST(message == "");
+}
+
+BOOST_AUTO_TEST_CASE(cipher_batch_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key"));
+  vector<string> indicator(M209::NUM_WHEELS, "A");
+  std::function<void(M209&, size_t, istream&, ostream&)> cipher =
+    [&](M209& machine, size_t, istream& is, ostream& os) {
+      string line;
+      getline(is, line);
+      if (line == "FAIL")
+        throw std::runtime_error("bad message");
+      // runs on the worker threads, so a failure is thrown to be counted
+      if (!machine.SetWheels(indicator))
+        throw std::logic_error("SetWheels failed");
+      for (char c : line)
+        os << machine.Cipher(c);
+      os << '\n';
+    };
+  string batch;
+  for (int i=0; i<50; ++i) {
+    batch += (i == 17) ? "FAIL" : string(100 + i, 'A' + i % 26);
+    batch += "\n%%\n";
+  }
+  
+  stringstream in1(batch), out1, in4(batch), out4, log;
+  Context context;
+  context.Log = &log;
+  m209.SetContext(context);
+  size_t count1 = 0, count4 = 0;
+  BOOST_TEST(CipherBatch(m209, 1, in1, out1, cipher, count1) == 1u);
+  BOOST_TEST(CipherBatch(m209, 4, in4, out4, cipher, count4) == 1u);
+  BOOST_TEST(count1 == 50u);
+  BOOST_TEST(count4 == 50u);
+  BOOST_TEST(out1.str() == out4.str());
+  BOOST_TEST(log.str().find("ERROR: message 18: bad message") != string::npos);
+  BOOST_TEST(log.str().find("SetWheels failed") == string::npos);
+  
+  stringstream empty, out_empty;
+  size_t count_empty = 1;
+  BOOST_TEST(CipherBatch(m209, 4, empty, out_empty, cipher, count_empty) == 0u);
+  BOOST_TEST(count_empty == 0u);
+  BOOST_TEST(out_empty.str() == "");
+  
+  // Outputs are in the order of the messages
+  string line;
+  getline(out4, line);
+  BOOST_REQUIRE(m209.SetWheels(indicator));
+  string first;
+  for (char c : string(100, 'A'))
+    first += m209.Cipher(c);
+  BOOST_TEST(line == first);
+}
+
+BOOST_AUTO_TEST_CASE(seek_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209, m209_seek;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key"));
+  BOOST_TEST(m209_seek.LoadKey(src_dir + "/tests/MB.m209key"));
+  vector<string> indicator{"B", "D", "F", "H", "J", "L"};
+  string plain;
+  for (int i=0; i<2000; ++i)
+    plain += 'A' + (i * 7 + i / 26) % 26;
+  BOOST_REQUIRE(m209.SetWheels(indicator));
+  string cipher;
+  for (char c : plain)
+    cipher += m209.Cipher(c);
+  
+  // Ciphering from letter n on matches the rest of the whole message
+  BOOST_REQUIRE(m209_seek.SetWheels(indicator));
+  for (uint64_t n : {0, 1, 5, 437, 1999, 1000, 3}) {
+    m209_seek.Seek(n);
+    string tail;
+    for (size_t i=n; i<plain.size(); i++)
+      tail += m209_seek.Cipher(plain[i]);
+    BOOST_TEST(tail == cipher.substr(n));
+  }
+  
+  // Indices past a full cycle of the wheels wrap around
+  m209_seek.Seek(M209::CYCLE * 3 + 437);
+  string tail;
+  for (size_t i=437; i<plain.size(); i++)
+    tail += m209_seek.Cipher(plain[i]);
+  BOOST_TEST(tail == cipher.substr(437));
+  m209_seek.ResetCounter();
+  BOOST_TEST(m209_seek.Cipher(plain[0]) == cipher[0]);
+  
+  // and so do letter counts past the range of an int
+  uint64_t far = M209::CYCLE * 40 + 437;
+  m209_seek.Seek(far);
+  string bulk(plain.size() - 437, ' ');
+  m209_seek.CipherBuffer(&plain[437], bulk.size(), &bulk[0]);
+  BOOST_TEST(bulk == cipher.substr(437));
+  m209_seek.ResetCounter();
+  BOOST_TEST(m209_seek.Cipher(plain[0]) == cipher[0]);
+}
+
+BOOST_AUTO_TEST_CASE(group_count_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key"));
+  string KeyListIndicator, NetIndicator;
+  vector<string> indicator(M209::NUM_WHEELS, "A");
+  
+  // Encipher 60 letters from letter start and return the output with
+  // every letter replaced by '.', leaving the grouping
+  auto Groups = [&](uint64_t start) {
+    BOOST_REQUIRE(m209.SetWheels(indicator));
+    m209.Seek(start);
+    stringstream in(string(60, 'A')), out;
+    m209.CipherStream(false, false, KeyListIndicator, NetIndicator, "",
+                      true, in, out, true);
+    string groups = out.str();
+    for (char& c : groups)
+      if (isalpha(c))
+        c = '.';
+    return groups;
+  };
+  
+  // Grouping past letter INT_MAX is that of a short message at the same
+  // place in a line
+  uint64_t start = INT_MAX - 7;
+  string far = Groups(start);
+  BOOST_TEST(far == Groups(start % 25));
+  BOOST_TEST(far.find("......") == string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(trace_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209, m209_traced;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key"));
+  BOOST_TEST(m209_traced.LoadKey(src_dir + "/tests/MB.m209key"));
+  vector<string> indicator{"B", "D", "F", "H", "J", "L"};
+  BOOST_REQUIRE(m209.SetWheels(indicator));
+  BOOST_REQUIRE(m209_traced.SetWheels(indicator));
+  stringstream log;
+  Context context;
+  context.Verbose = true;
+  context.Log = &log;
+  m209_traced.SetContext(context);
+  
+  // Enough letters to fill the trace buffer more than once
+  string in(10000, 'A');
+  for (size_t i=0; i<in.size(); ++i)
+    in[i] = 'A' + (i * 7 + i / 26) % 26;
+  string out(in.size(), ' '), out_traced(in.size(), ' ');
+  m209.CipherBuffer(&in[0], in.size(), &out[0]);
+  m209_traced.CipherBuffer(&in[0], in.size(), &out_traced[0]);
+  BOOST_TEST(out == out_traced);
+  
+  string line;
+  size_t lines = 0;
+  while (getline(log, line))
+    ++lines;
+  BOOST_TEST(lines == in.size());
+  BOOST_TEST(log.str().find("Counter: 0001  Wheels: BDFHJL") == 0u);
+  BOOST_TEST(log.str().find("Counter: 10000  Wheels: ") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(wheel_type_test){
+  WheelType type({"A", "B", "C", "D", "E"}, -2);
+  BOOST_TEST(type.GetSize() == 5);
+  BOOST_TEST(type.Find("D") == 3);
+  BOOST_TEST(type.Find("Z") == -1);
+  BOOST_CHECK_THROW(WheelType({"A", "B", "A"}, 0), std::invalid_argument);
+  
+  // Wheels of one type share its names
+  Keywheel w1, w2;
+  w1.SetType(type);
+  w2.SetType(type);
+  BOOST_TEST(w1.GetType() == w2.GetType());
+  BOOST_TEST(w1.GetWheelSize() == 5);
+  w1.SetPosByName("B");
+  BOOST_TEST(w1.GetPosition() == 1);
+  BOOST_TEST(w1.GetOffsetName() == "E");
+  BOOST_TEST(&w1.GetPosNameAt(2) == &w2.GetPosNameAt(2));
+  BOOST_CHECK_THROW(w2.SetPosByName("Z"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(try_set_positions_test){
+  string src_dir(getenv("MESON_SOURCE_ROOT"));
+  M209 m209;
+  BOOST_TEST(m209.LoadKey(src_dir + "/tests/MB.m209key"));
+  
+  // Z is not on the sixth wheel, so it is skipped for the next name
+  const char* names[] = {"B", "D", "F", "H", "J", "Z", "L"};
+  BOOST_TEST(!m209.TrySetPositions(names, 6));
+  BOOST_TEST(m209.TrySetPositions(names, 7));
+  vector<string> indicator{"B", "D", "F", "H", "J", "L"};
+  M209 m209_ref;
+  BOOST_TEST(m209_ref.LoadKey(src_dir + "/tests/MB.m209key"));
+  BOOST_TEST(m209_ref.SetWheels(indicator));
+  string in(100, 'A'), out(in.size(), ' '), out_ref(in.size(), ' ');
+  m209.CipherBuffer(&in[0], in.size(), &out[0]);
+  m209_ref.CipherBuffer(&in[0], in.size(), &out_ref[0]);
+  BOOST_TEST(out == out_ref);
+  
+  // Names longer than a letter take the sorted lookup
+  WheelType type({"A", "03", "B", "05"}, 0);
+  BOOST_TEST(type.Find("05") == 3);
+  BOOST_TEST(type.Find("04") == -1);
+  BOOST_TEST(type.Find("") == -1);
+  Keywheel w;
+  w.SetType(type);
+  BOOST_TEST(w.TrySetPosByName("03"));
+  BOOST_TEST(w.GetPosition() == 1);
+  BOOST_TEST(!w.TrySetPosByName("C"));
+  BOOST_TEST(w.GetPosition() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(pin_sampler_test){
+  for (int max_run : {3, 6}) {
+    PinSampler sampler(max_run);
+    for (int size : {13, 17}) {
+      // Count the valid settings by brute force
+      set<uint64_t> valid;
+      for (uint64_t pins=0; pins < (uint64_t(1) << size); ++pins) {
+        int weight = 0, run = 0, longest = 0;
+        for (int i=0; i<2*size; ++i) {
+          int pin = (pins >> (i % size)) & 1;
+          if (i < size)
+            weight += pin;
+          run = (i > 0 && pin == int((pins >> ((i-1) % size)) & 1)) ? run+1 : 1;
+          longest = std::max(longest, run);
+        }
+        if (10*weight >= 4*size && 10*weight <= 6*size && longest <= max_run)
+          valid.insert(pins);
+      }
+      BOOST_TEST(sampler.Count(size) == valid.size());
+      
+      // Pattern numbers each valid setting once
+      set<uint64_t> patterns;
+      for (uint64_t i=0; i<sampler.Count(size); ++i)
+        patterns.insert(sampler.Pattern(size, i));
+      BOOST_TEST((patterns == valid));
+      BOOST_CHECK_THROW(sampler.Pattern(size, sampler.Count(size)),
+                        std::invalid_argument);
+      BOOST_TEST(valid.count(sampler.Sample(size, gen)) == 1u);
+    }
+  }
+  BOOST_CHECK_THROW(PinSampler(7), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(top_reservoir_test){
+  ChaChaRandom rng(24);
+  
+  // Ten items tie for the best score: each is picked equally often and
+  // the lower scores never are
+  const int trials = 20000;
+  vector<int> picked(20, 0);
+  for (int t=0; t<trials; ++t) {
+    TopReservoir<int> best(3);
+    for (int i=0; i<20; ++i)
+      best.Offer(i < 10 ? 5 : i % 5, i, rng);
+    BOOST_REQUIRE(best.size() == 3u);
+    picked[best.Pick(rng)]++;
+  }
+  bool f_okay = true;
+  for (int i=0; i<20; ++i) {
+    if (i < 10)
+      f_okay &= std::abs(picked[i] - trials / 10) < 300;
+    else
+      f_okay &= picked[i] == 0;
+  }
+  BOOST_TEST(f_okay);
+  
+  // With fewer ties than room the next best are kept too
+  TopReservoir<int> best(3);
+  best.Offer(1, 1, rng);
+  best.Offer(7, 7, rng);
+  best.Offer(3, 3, rng);
+  best.Offer(0, 0, rng);
+  best.Offer(4, 4, rng);
+  set<int> kept;
+  for (int t=0; t<100; ++t)
+    kept.insert(best.Pick(rng));
+  BOOST_TEST((kept == set<int>{3, 4, 7}));
+  BOOST_CHECK_THROW(TopReservoir<int>(3).Pick(rng), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(first_success_test){
+  // Candidate 6 is the first success. 8 succeeds sooner and 7 only ends
+  // when cancelled, so neither may be taken in its place.
+  std::function<bool(const int&, int&, const std::atomic<bool>&)> search =
+    [](const int& c, int& result, const std::atomic<bool>& cancel) {
+      if (c == 6)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      if (c == 7)
+        while (!cancel)
+          std::this_thread::yield();
+      result = 10 * c;
+      return c >= 6;
+    };
+  for (unsigned jobs : {1u, 4u}) {
+    int next = 0, candidate = -1, result = -1;
+    FirstSuccess<int, int>(jobs, [&]() { return next++; }, search,
+                           candidate, result);
+    BOOST_TEST(candidate == 6);
+    BOOST_TEST(result == 60);
+    
+    next = 0;
+    BOOST_CHECK_THROW((FirstSuccess<int, int>(jobs, [&]() { return next++; },
+                        [](const int& c, int&, const std::atomic<bool>&) {
+                          if (c == 2)
+                            throw std::runtime_error("search failed");
+                          return c == 4;
+                        }, candidate, result)),
+                      std::runtime_error);
+  }
+  
+  // GenKey gives a good drum searching several NumArrays at once
+  M209 m209;
+  m209.SetSearchJobs(4);
+  m209.GenKey1944();
+  KeyRecord record = m209.GetKeyRecord("", "");
+  M209::DrumType drum;
+  for (size_t i=0; i<M209::NUM_LUG_BARS; ++i)
+    drum[i] = bitset<M209::NUM_WHEELS>(record.lugs[i]);
+  BOOST_TEST(m209.ValidateDrum(drum));
+  
+  // and with a seed the same key for any number of jobs
+  stringstream key1, key4;
+  for (unsigned jobs : {1u, 4u}) {
+    M209::DrumSearchCache.clear();
+    m209.SetSearchJobs(jobs);
+    gen.seed(1944);
+    m209.GenKey1944();
+    m209.PrintKey("", "", jobs == 1 ? key1 : key4);
+  }
+  BOOST_TEST(key1.str() == key4.str());
+}